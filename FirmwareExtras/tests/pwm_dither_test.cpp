@@ -0,0 +1,104 @@
+// Host test for the output maps and sigma-delta dither of brWheel_my/pwm.ino (option USE_PWM_DITHER)
+// The integer map and dither code is included straight from brWheel_my/pwm_map.h, so this tests the firmware code itself.
+// For TOP 400, 2047 and 65535 every map of the output modes (full range, 0-50-100 half range up and down,
+// FFB balance, min torque offset) is driven with constant torque for 4096 ticks, the averaged output has to
+// match the exact mapped value within 0.001 LSB and no single output may leave the map range.
+// Output mode index of every pwmstate is also checked against the modes pwmBind() selects (dither is enabled per mode).
+//
+// build and run:  g++ -O2 -o pwm_dither_test pwm_dither_test.cpp && ./pwm_dither_test
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+typedef uint8_t u8;
+typedef int8_t b8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef int32_t s32;
+
+#define constrain(x, lo, hi) ((x) < (lo) ? (lo) : ((x) > (hi) ? (hi) : (x)))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define USE_PWM_DITHER
+
+u16 MM_MAX_MOTOR_TORQUE;
+
+#include "../../brWheel_my/pwm_map.h"
+
+#define TICKS 4096
+
+static int fails = 0;
+
+// drives one map with constant torque magnitude a, returns worst error of the average in LSB
+static double check(s32 lo, s32 hi, u32 a, bool dither) {
+  pwmDitherSet(dither);
+  pwmSetMap(0, 2, lo, hi);
+  double sum = 0;
+  s32 mn = (lo < hi) ? lo : hi;
+  s32 mx = (lo < hi) ? hi : lo;
+  for (int t = 0; t < TICKS; t++) {
+    u16 o = pwmMapOut(&pwmMaps[0][2], a, 0);
+    if (o < mn || o > mx) {
+      printf("  out of range: lo %d hi %d a %u -> %u\n", lo, hi, a, o);
+      fails++;
+      return 1e9;
+    }
+    sum += o;
+  }
+  double exact = lo + double(hi - lo) * a / MM_MAX_MOTOR_TORQUE;
+  return fabs(sum / TICKS - exact);
+}
+
+int main() {
+  const u16 tops[] = {400, 2047, 65535};
+  for (u16 top : tops) {
+    MM_MAX_MOTOR_TORQUE = top;
+    s32 mid = top >> 1;
+    const s32 maps[][2] = {
+      {0, top}, // pwm+-, pwm+dir, dac+-
+      {mid, top}, // 0-50-100, positive half
+      {mid, 0}, // 0-50-100, negative half (output falls with torque)
+      {0, s32(0.7 * top)}, // FFB balance
+      {top / 10, top}, // min torque offset
+    };
+    double worstOn = 0, worstOff = 0;
+    for (auto &m : maps) {
+      for (u32 a = 0; a <= top; a += (top / 97) + 1) {
+        double e = check(m[0], m[1], a, true);
+        if (e > worstOn) worstOn = e;
+        e = check(m[0], m[1], a, false);
+        if (e > worstOff) worstOff = e;
+      }
+      double e = check(m[0], m[1], top, true); // full torque must reach hi exactly
+      if (e > worstOn) worstOn = e;
+    }
+    printf("TOP %5u: max error of averaged output %.4f LSB with dither, %.4f LSB without\n", top, worstOn, worstOff);
+    if (worstOn > 0.001) {
+      printf("  FAIL: dithered average is off by more than 0.001 LSB\n");
+      fails++;
+    }
+    if (worstOff > 1.0) {
+      printf("  FAIL: undithered output is off by more than 1 LSB\n");
+      fails++;
+    }
+  }
+  int modeFails = 0;
+  // output mode of every pwmstate, as pwmBind() picks it (pwm: bit1, bit6, dac: bit6, bit5, bit7 enables dac output)
+  for (int st = 0; st < 256; st++) {
+    u8 pwm = (bitRead(st, 1) ? (bitRead(st, 6) ? 3 : 2) : (bitRead(st, 6) ? 1 : 0)); // +-, 0-50-100, +dir, rcm
+    u8 dac = bitRead(st, 6) ? 2 : (bitRead(st, 5) ? 1 : 0); // dac+dir does not look at bit5
+    if (pwmModeIndex(st, false) != pwm || pwmModeIndex(st, true) != dac) {
+      printf("  FAIL: pwmstate 0x%02x gives mode %u/%u, expected %u/%u (pwm/dac)\n", st, pwmModeIndex(st, false), pwmModeIndex(st, true), pwm, dac);
+      modeFails++;
+    }
+  }
+  if (pwmModeIndex(0xE0, true) != 2) { // dac+dir with bit5 set used to land in the rcm slot
+    printf("  FAIL: dac+dir with bit5 set is not in dac+dir slot\n");
+    modeFails++;
+  }
+  printf("output mode index of all pwmstate values: %s\n", modeFails ? "FAIL" : "OK");
+  fails += modeFails;
+  printf(fails ? "FAILED\n" : "OK\n");
+  return fails ? 1 : 0;
+}
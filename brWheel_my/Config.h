@@ -42,26 +42,67 @@ typedef float f32;
 //#define USE_TWOFFBAXIS        // milos, uncomment to enable 2nd FFB axis and PWM/DAC output for flight sticks (can't be used with USE_LOAD_CELL and without USE_ANALOGFFBAXIS)
 //#define USE_AS5600          // milos, uncomment to enable magnetic encoder via i2C instead of optical encoder
 //#define USE_TCA9548        // milos, uncomment to enable i2C multiplexer chip for using more than one AS5600 magnetic sensor via i2C (for now only used as y-axis input, must use with AS5600 and TWOFFBAXIS) 
+//#define USE_TWI_ASYNC      // uncomment to read AS5600 magnetic encoders, ADS1015 pedals and write MCP4725 DACs in the background with interrupt driven 400kHz i2C (AVR only, replaces Wire library, can not be used with USE_LCD)
 //#define USE_ZINDEX          // milos, use Z-index encoder channel (caution, can not be used with USE_ADS1015, USE_MCP4725 or USE_AS5600)
 //#define USE_LOAD_CELL				// Load cell shield // milos, new library for LC (caution can not be used with TWOFFBAXIS)
 //#define USE_SHIFT_REGISTER			// 2x8-bit parallel-load shift registers G27 board steering wheel (milos, this one I modified for 16 buttons, caution can not be used with TWOFFBAXIS)
 //#define USE_DUAL_SHIFT_REGISTER		// Dual 8-bit Parallel-load shift registers G27 board shifter  (milos, not available curently, use SN74ALS166N instead for 24 buttons)
 //#define USE_SN74ALS166N          // milos, uncomment to use 3x8bit parralel-in serial-out shift register chips for 24 buttons, otherwise it's 16 buttons with ard nano-button box (must be used with USE_SHIFT_REGISTER)
+//#define USE_SHIFTREG_SPI     // uncomment to clock shift register chain with hardware SPI in the background, CLK and DATA move to SCK and MISO pins (AVR only, must be used with USE_SHIFT_REGISTER, can not be used with USE_DSP56ADC16S)
 //#define USE_XY_SHIFTER    // milos, uncomment to use XY analog shifter (can not be used with USE_BTNMATRIX, note that for proMicro clutch and handbrake will be unavailable)
 //#define USE_HATSWITCH        // milos, uncomment to use first 4 buttons for hat switch (D-pad)
 //#define USE_BTNMATRIX        // milos, uncomment to use 8 pins as a 4x4 button matrix for total of 16 buttons (can not be used with load cell, shift register or XY shifter)
 //#define AVG_INPUTS        // milos, uncomment to use averaging of arduino analog inputs (can not be used with USE_ADS1015)
+//#define USE_ADC_SEQ       // uncomment to sample arduino analog inputs in the background with ADC interrupt, 16x oversampled to 12bit, enables AVG_INPUTS (on RP2040 it's round robin ADC with DMA, can not be used with USE_ADS1015)
+//#define USE_DEBOUNCE      // uncomment to debounce all buttons (button changes only after it reads the same for 2^DEBOUNCE_BITS control ticks)
 //#define USE_AUTOCALIB        // milos, uncomment to use autocalibration for pedal axis (if left commented manual calibration is enabled)
+//#define USE_PEDAL_CURVES     // uncomment to shape pedal response on the wheel, 17 point curve for each pedal stored in EEPROM (set with serial command K)
 //#define USE_SPLITAXIS   // milos, uncomment to split Z-axis into two combined gas and brake axis (only available if Y-axis is not used by AS5600 or loadcell)
 //#define USE_CENTERBTN    // milos, uncomment to assign digital input pin D2 (or TX) for hardware wheel recenter to 0deg (caution, can only be used if quad encoder usage is commented out)
 //#define USE_EXTRABTN    // milos, uncomment to configure analog inputs on pins A2 and A3 as a digital button inputs (2 extra buttons, note that clutch and handbrake will be unavailable)
 //#define USE_MCP4725      // milos, 12bit DAC (0-5V), uncomment to enable output of FFB signal as 2ch DAC voltage output
+//#define USE_TORQUE_LUT    // uncomment to linearize FFB output with a 17 point torque curve stored in EEPROM, replaces min torque offset (set with serial command T)
+//#define USE_PWM_SYNC      // uncomment to apply PWM duty and direction together at PWM period boundary, output is held at zero for PWM_DEADTIME periods on direction reversal (AVR only, can not be used with USE_MCP4725 or USE_TWOFFBAXIS)
+//#define USE_PWM_DITHER    // uncomment to dither FFB output value with first order sigma-delta, so averaged output keeps sub-LSB torque detail (enabled per output mode with PWM_DITHER_MODES)
+//#define USE_PROFILER      // uncomment to time each stage of FFB tick, input report and serial interface, min/max/mean and log2 histogram per stage can be read with serial command DP
+//#define USE_COGGING       // uncomment to add position dependent cogging and friction compensation to xFFB output, map is learned on device with serial command Q and stored in EEPROM (only with USE_QUADRATURE_ENCODER)
 //#define USE_ANALOGFFBAXIS // milos, uncomment to enable other than X-axis to be tied with xFFB axis (you can use analog inputs instead of digital encoders
 //#define USE_PROMICRO    // milos, uncomment if you are using Arduino ProMicro board (leave commented for Leonardo or Micro variants)
 #define USE_EEPROM     // milos, uncomment to enable loading/saving settings from EEPROM (if commented out, default settings will be loaded on each powerup, one needs to reconfigure firmware defautls or use GUI configuration after each powerup) 
 
 #define CALIBRATE_AT_INIT	0 // milos, was 1
 
+#if defined(ARDUINO_ARCH_RP2040) && defined(USE_TWI_ASYNC)
+#error "USE_TWI_ASYNC uses AVR-specific TWI registers and is not supported on RP2040."
+#endif
+#if defined(USE_TWI_ASYNC) && defined(USE_LCD)
+#error "USE_TWI_ASYNC has its own TWI interrupt, LCD library needs Wire."
+#endif
+#if defined(ARDUINO_ARCH_RP2040) && defined(USE_ADC_SEQ) && defined(USE_XY_SHIFTER)
+#error "USE_ADC_SEQ on RP2040 samples pedal inputs only, XY shifter has no spare ADC inputs."
+#endif
+#if defined(ARDUINO_ARCH_RP2040) && defined(USE_PWM_SYNC)
+#error "USE_PWM_SYNC uses AVR-specific timer interrupts and is not supported on RP2040."
+#endif
+#if defined(USE_PWM_SYNC) && (defined(USE_MCP4725) || defined(USE_TWOFFBAXIS))
+#error "USE_PWM_SYNC only works with single axis PWM output."
+#endif
+#if defined(USE_COGGING) && (!defined(USE_QUADRATURE_ENCODER) || defined(USE_AS5600))
+#error "USE_COGGING needs the optical quadrature encoder for motor position."
+#endif
+#if defined(ARDUINO_ARCH_RP2040) && defined(USE_SHIFTREG_SPI)
+#error "USE_SHIFTREG_SPI uses AVR-specific SPI registers and is not supported on RP2040."
+#endif
+#if defined(USE_SHIFTREG_SPI) && defined(USE_DSP56ADC16S)
+#error "USE_SHIFTREG_SPI and USE_DSP56ADC16S both need the SPI hardware."
+#endif
+
+#ifdef USE_ADC_SEQ // background samples are averaged, so axis are scaled the same way as with averaging
+#ifndef AVG_INPUTS
+#define AVG_INPUTS
+#endif
+#endif // end of adc seq
+
 //------------------------------------- Pins -------------------------------------------------------------
 
 //#define LED_PIN				12
@@ -155,8 +196,13 @@ typedef float f32;
 
 #ifdef USE_SHIFT_REGISTER // milos, added
 #define SHIFTREG_PL 8 // PL SH/LD (Shift or Load input) // milos, was 4
+#ifndef USE_SHIFTREG_SPI
 #define SHIFTREG_CLK 7 // CLOCK 8-bit Parallel shift // milos, was 5
 #define SHIFTREG_DATA_SW 6 // DATA from Steering Wheel
+#else // hardware SPI pins (on ICSP header for Leonardo and Micro)
+#define SHIFTREG_CLK 15 // D15 or SCK, bit1 of PORTB
+#define SHIFTREG_DATA_SW 14 // D14 or MISO, bit3 of PINB
+#endif // end of shift reg spi
 //#define SHIFTREG_DATA_H 7 // DATA from Shifter H (Dual 8-bit) //milos, not in use
 //#define SHIFTREG_DATA_OUT 13 // DATA Shift-Out LED (8-bit)   ###### NOT YET IMPLEMENTED ###### //milos, was 3
 #define SHIFTS_NUM 33 // milos, defines number of shifts (16) from the nano button box (depends on number of buttons we want to read, max is 65 for 32 buttons but we have only 24 ih hid, see inputs.ino and hid.cpp)
@@ -165,6 +211,12 @@ typedef float f32;
 #define SHIFTS_NUM 49 // milos, for 24 shifts (3x8bit shift register chips)
 #endif // end of xy shifter
 #endif // end of sn74
+#define SHIFTREG_BYTES ((SHIFTS_NUM - 1) / 16) // number of whole bytes clocked in per frame (2 shifts per bit)
+#ifdef USE_SN74ALS166N
+#define SHIFTREG_SPI_SPR 0 // SPI clock rate select, F_CPU/4 = 4MHz for shift register chips
+#else
+#define SHIFTREG_SPI_SPR 2 // F_CPU/64 = 250kHz, nano button box needs time to reload its SPI data register between bytes (0-4MHz, 1-1MHz, 2-250kHz, 3-125kHz)
+#endif // end of sn74
 #else // milos, if no shift reg re-alocate some pins for buttons 4-6 instead
 #define BUTTON4 6 // D6 or bit7 of PIND
 #define B4PORTBIT 7 // bit7
@@ -269,6 +321,11 @@ typedef float f32;
 #endif
 #endif // ARDUINO_ARCH_RP2040
 
+#define LC_DOUT_PIN 4 // HX711 data pin (D4 has no interrupt on 32U4, so it is polled from main loop)
+#define LC_SCK_PIN  5 // HX711 clock pin
+#define LC_TARE_SAMPLES 8 // number of HX711 samples averaged for load cell zero offset
+#define LC_SETTLE_MS 2000 // ms after powerup before load cell tare is taken, HX711 output drifts while it warms up
+
 uint8_t LC_scaling; // milos, load cell scaling factor (affects brake pressure, but depends on your load cell's maximum specified load)
 // usage:   1 : min value, not recommended due to resolution loss
 //          4 : the most sensitive and a very light brake (1:1 reading from 24bit ADC)
@@ -318,6 +375,10 @@ uint8_t LC_scaling; // milos, load cell scaling factor (affects brake pressure,
 #define PARAM_ADDR_CLUT_HI       0x34 //milos, clutch pedal cal max
 #define PARAM_ADDR_HBRK_LO       0x36 //milos, hand brake pedal cal min
 #define PARAM_ADDR_HBRK_HI       0x38 //milos, hand brake pedal cal max
+#define PARAM_ADDR_PEDAL_CURVE   0x3A // pedal response curves, 4x17 u16 points (brake, accelerator, clutch, hand brake)
+#define PARAM_ADDR_TORQUE_LUT    0xC2 // torque linearization curve, 17 u16 points
+#define PARAM_ADDR_COG_MAP       0xE4 // cogging compensation map, COG_BINS s8 bins per motor revolution (space for up to 512)
+#define PARAM_ADDR_COG_FRIC      0x2E4 // friction compensation, u8 (0xFF - not learned yet)
 
 #define FIRMWARE_VERSION         0xFA // milos, firmware version (FA=250, FB=251, FC=252, FD=253)
 
@@ -330,6 +391,27 @@ uint8_t LC_scaling; // milos, load cell scaling factor (affects brake pressure,
 #define CONTROL_PERIOD	2000 // milos, original 2000 (us), be careful since this defines ffb calculation rate (min is 1000us for max 1000Hz ffb calc rate, but 16MHz clock is not fast enough)
 //#define SEND_PERIOD		4000 // milos, commented out
 #define CONFIG_SERIAL_PERIOD 10000 // milos, original 50000 (us)
+#define TASK_FFB_BUDGET      800 // us, worst case run time of FFB task (encoder, FFB calculation and output)
+#define TASK_REPORT_BUDGET   700 // us, worst case run time of report task (pedals, buttons and USB input report)
+#define TASK_CONFIG_BUDGET   500 // us, worst case run time of serial interface task (lower priority tasks only start if their budget fits before next FFB tick)
+#define TASK_BOOT_BUDGET     300 // us, worst case run time of one deferred boot step (LCD init is longer, but it runs only once)
+#define BOOT_PERIOD        20000 // us, deferred boot steps are this far apart (also half period of startup LED blink)
+
+#define BOOT_LCD       0 // deferred boot stages, run by boot task after USB input reports are already going out
+#define BOOT_CAL       1
+#define BOOT_LOAD_CELL 2
+#define BOOT_DONE      3
+
+typedef struct task { // entry of static task table, see loop()
+  void (*run)();
+  u16 period; // us
+  u16 phase; // us, offset of first release from first FFB tick
+  u16 budget; // us
+  u32 release; // next release time
+  u16 overruns; // runs that took longer than budget
+  u16 misses; // releases that were dropped because task started a full period late
+  u16 maxTime; // us, longest run since powerup
+};
 
 //------------------------------------- FFB/Firmware config -----------------------------------------------------
 
@@ -559,10 +641,41 @@ typedef struct s32v { // milos, added - 2 dimensional vector structure (for ffb
 #endif // end of 2 ffb axis
 };
 
+typedef void (*pwmStage)(s32v *torque); // output stage for one pwmstate mode
+
 f32 FFB_bal; // milos, FFB balance slider
 f32 L_bal; // milos, left PWM balance multiplier
 f32 R_bal; // milos, right PWM balance multiplier
 f32 minTorquePP; // milos, added - min torque in percents
+#ifdef USE_TORQUE_LUT
+#define TORQUE_LUT_POINTS 17 // points of torque curve, 16 linear segments from zero to full torque
+#define TORQUE_LUT_BITS   12
+#define TORQUE_LUT_ONE    (1 << TORQUE_LUT_BITS) // curve point value for full torque
+#endif // end of torque lut
+#ifdef USE_COGGING
+// cogging repeats LCM(slots, poles) times per motor revolution (about 10-20 for brushed motors), each period needs at least 4 bins
+// RAM use is 4 bytes per bin (map, learning sums and counts), 7 bits (128 bins, 512 bytes) is enough for brushed motors with up to 32 cogging periods
+#define COG_BINS_BITS   7
+#define COG_BINS        (1 << COG_BINS_BITS) // map bins per motor revolution (max 512, EEPROM space)
+#define COG_RATIO       1 // motor revolutions per wheel revolution, encoder counts per motor revolution are CPR / COG_RATIO
+#define COG_LEARN_BITS  (COG_BINS_BITS + 5) // 2^12 control periods for one motor revolution of learning sweep (about 8s), 32 samples per bin each way
+#define COG_ONE_BITS    10
+#define COG_ONE         (1 << COG_ONE_BITS) // map value for full torque, map holds up to +-1/8 and friction up to 1/4 of full torque
+#define COG_IDLE        0 // learning states, readout with serial command QS
+#define COG_SETTLE      1
+#define COG_FWD         2
+#define COG_REV         3
+#define COG_FAIL        4
+#endif // end of cogging
+#define PWM_KEEP     0xFF // dir pin is not used by output mode
+#define PWM_NO_DRIVE 0xFF // no force, so no direction to reverse from
+#ifdef USE_PWM_DITHER
+// bit for each output mode: bit0 pwm+- (dac+-), bit1 pwm0-50-100 (dac0-50-100), bit2 pwm+dir (dac+dir), bit3 rcm (servo drives may treat dither as jitter)
+#define PWM_DITHER_MODES 0b0111
+#endif // end of pwm dither
+#ifdef USE_PWM_SYNC
+#define PWM_DEADTIME 1 // pwm periods with zero output before direction pin or pwm+- side is switched (min 1)
+#endif // end of pwm sync
 
 // milos, added - RCM pwm mode definitions
 f32 RCM_min = 1.0; // minimal RCM pulse width in ms
@@ -579,35 +692,27 @@ f32 RCMscaler (byte value) { // milos, added - scales correctly RCM pwm mode
 
 boolean zIndexFound = false; // milos, added - keeps track if z-index pulse from encoder was found after powerup
 #ifdef USE_AS5600
+#if defined(USE_TWOFFBAXIS) && defined(USE_TCA9548)
+#define AS5600_NUM 2 // 2nd magnetic encoder on y-axis, behind i2C multiplexer
+#else
+#define AS5600_NUM 1
+#endif
 #ifdef USE_CENTERBTN
 boolean cButtonPressed = false; // milos, added - gets true when we press center button (activated via interrupt function)
 #endif // end of as5600
 #endif // end of center btn
 
+#ifdef USE_DEBOUNCE
+#define DEBOUNCE_BITS 2 // bits of vertical counter, button must read the same for 2^DEBOUNCE_BITS samples in a row to change (1-2, 2-4, 3-8 samples, one sample per control tick)
+#endif // end of debounce
+
 // milos, added - function for decoding hat switch bits
+// hat value for each combination of first 4 buttons (bit0-up, bit1-right, bit2-down, bit3-left), 0 is centered, invalid combinations are centered too
+const uint8_t hatTable[16] PROGMEM = {0, 1, 3, 2, 5, 0, 4, 0, 7, 8, 0, 0, 6, 0, 0, 0};
+
 uint32_t decodeHat(uint32_t inbits) {
-  byte hat;
-  byte dec = 0b00001111 & inbits; //milos, only take 1st 4 bits from inbits
-  if (dec == 1) { //up
-    hat = 1;
-  } else if (dec == 2) { //right
-    hat = 3;
-  } else if (dec == 4) { //down
-    hat = 5;
-  } else if (dec == 8) { //left
-    hat = 7;
-  } else if (dec == 3) { //up_right
-    hat = 2;
-  } else if (dec == 6) { //down_right
-    hat = 4;
-  } else if (dec == 9) { //up_left
-    hat = 8;
-  } else if (dec == 12) { //down_left
-    hat = 6;
-  } else {
-    hat = 0;
-  }
-  return ((inbits & 0b11111111111111111111111111110000) | (hat & 0b00001111)); // milos, put hat bits into first 4 bits of buttons and keep the rest unchanged
+  uint8_t hat = pgm_read_byte(&hatTable[inbits & 0b00001111]); //milos, only take 1st 4 bits from inbits
+  return ((inbits & 0b11111111111111111111111111110000) | hat); // milos, put hat bits into first 4 bits of buttons and keep the rest unchanged
 }
 
 typedef struct xysh { // milos, added - holds shifter configuration
@@ -626,53 +731,44 @@ typedef struct xysh { // milos, added - holds shifter configuration
   //bit3=1: Y-axis inverted
   int16_t x; // horizontal position
   int16_t y; // vertical position
+  uint8_t zx; // current X zone (0-3, left to right), kept for hysteresis
+  uint8_t zy; // current Y zone (0-even gears, 1-neutral, 2-odd gears), kept for hysteresis
+};
+
+// hysteresis for each calibration limit (same order as cal[]), shifter has to move this far past a limit to leave the zone it is in
+const uint8_t xyHyst[5] = {16, 16, 16, 16, 16};
+
+// gear for each zone, index is X zone * 3 + Y zone, value is output bit + 1 (0 - neutral)
+#define XY_N    0 // neutral
+#define XY_R    1 // reverse gear, bit0
+#define XY_G(n) (16 + (n)) // n-th gear, bits 16-23
+// table row is 8 gear mode * 2 + reverse button, reverse replaces 6th gear in 6 gear mode and 8th gear in 8 gear mode
+const uint8_t xyGears[4][12] PROGMEM = {
+  {XY_G(2), XY_N, XY_G(1), XY_G(4), XY_N, XY_G(3), XY_G(6), XY_N, XY_G(5), XY_G(8), XY_N, XY_G(7)}, // 6 gears
+  {XY_G(2), XY_N, XY_G(1), XY_G(4), XY_N, XY_G(3), XY_R,    XY_N, XY_G(5), XY_G(8), XY_N, XY_G(7)}, // 6 gears, reverse button
+  {XY_G(2), XY_N, XY_G(1), XY_G(4), XY_N, XY_G(3), XY_G(6), XY_N, XY_G(5), XY_G(8), XY_N, XY_G(7)}, // 8 gears
+  {XY_G(2), XY_N, XY_G(1), XY_G(4), XY_N, XY_G(3), XY_G(6), XY_N, XY_G(5), XY_R,    XY_N, XY_G(7)}  // 8 gears, reverse button
 };
 
+// zone of v among n ascending limits, limits around current zone z are moved away from it by their hysteresis
+uint8_t xyZone(int16_t v, const uint16_t *lim, const uint8_t *hyst, uint8_t n, uint8_t z) {
+  uint8_t r = 0;
+  for (uint8_t k = 0; k < n; k++) {
+    int16_t t = (k < z) ? lim[k] - hyst[k] : lim[k] + hyst[k];
+    if (v >= t) r++;
+  }
+  return r;
+}
+
 // milos - added, function for decoding XY shifter analog values into last 8 buttons
 uint32_t decodeXYshifter (uint32_t inbits, xysh *s) {
   uint32_t gears = 0; // shifter gears represented as digital buttons (1 bit for each gear)
   const uint8_t InpRevButtonBit = 0; // input reverse gear button bit number (normal buttons start from bit4, bit0-bit3 are reserved for hat switch)
-  const uint8_t OutRevButtonBit = 0; // output reverse gear button bit number (this is where we want to put reverse gear button, out of 24 available buttons)
-  if (bitRead(s->cfg, 0)) {   // if reverse gear button is inverted (logitech shifters)
-    if (bitRead(inbits, InpRevButtonBit + 4)) { // read rev gear button bit
-      bitClear(inbits, InpRevButtonBit + 4); // if 1, set rev gear bit to 0
-    } else {
-      bitSet(inbits, InpRevButtonBit + 4); // if 0, set rev gear bit to 1
-    }
-  }
-  if (s->x < s->cal[0] && s->y >= s->cal[4]) { // 1st gear
-    bitSet(gears, 16);
-  } else if (s->x < s->cal[0] && s->y < s->cal[3]) { // 2nd gear
-    bitSet(gears, 17);
-  } else if (s->x >= s->cal[0] && s->x < s->cal[1] && s->y >= s->cal[4]) { // 3rd gear
-    bitSet(gears, 18);
-  } else if (s->x >= s->cal[0] && s->x < s->cal[1] && s->y < s->cal[3]) { // 4th gear
-    bitSet(gears, 19);
-  } else if (s->x >= s->cal[1] && s->x < s->cal[2] && s->y >= s->cal[4]) { // 5th gear
-    bitSet(gears, 20);
-  } else if (s->x >= s->cal[1] && s->x < s->cal[2] && s->y < s->cal[3]) { // 6th gear
-    if (bitRead(s->cfg, 1)) { // if 8 gear shifter
-      bitSet(gears, 21); // set 6th gear
-    } else { // if 6 gear shifter
-      if (bitRead(inbits, InpRevButtonBit + 4)) {
-        bitSet(gears, OutRevButtonBit); // reverse gear
-      } else {
-        bitSet(gears, 21); // still set 6th gear
-      }
-    }
-  } else if (s->x >= s->cal[2] && s->y >= s->cal[4]) { // 7th gear
-    bitSet(gears, 22);
-  } else if (s->x >= s->cal[2] && s->y < s->cal[3]) { // 8th gear
-    if (bitRead(s->cfg, 1)) { // if 8 gear shifter
-      if (bitRead(inbits, InpRevButtonBit + 4)) {
-        bitSet(gears, OutRevButtonBit); // reverse gear
-      } else {
-        bitSet(gears, 23); // set 8th gear
-      }
-    } else { // if 6 gear shifter
-      bitSet(gears, 23); // still set 8th gear
-    }
-  }
+  s->zx = xyZone(s->x, &s->cal[0], &xyHyst[0], 3, s->zx);
+  s->zy = xyZone(s->y, &s->cal[3], &xyHyst[3], 2, s->zy);
+  uint8_t rev = bitRead(inbits, InpRevButtonBit + 4) ^ bitRead(s->cfg, 0); // reverse gear button, inverted for logitech shifters
+  uint8_t g = pgm_read_byte(&xyGears[(bitRead(s->cfg, 1) << 1) | rev][s->zx * 3 + s->zy]);
+  if (g != XY_N) gears = 1UL << (g - 1);
   // milos, on leonardo/micro when both xy shifter and hat switch are used pins D5,D6,D7 are remaped to buttons 0,1,2
   // milos, so we need to stop reading these pins twice as normal buttons
   // milos, pins D5,D6,D7 are taken care of by bit mask at bit4,bit5,bit7 in xy shifter decoding function bellow
@@ -709,6 +805,28 @@ typedef struct s32a { // milos, added - holds individual bit axis properties
 };
 
 const uint8_t avgSamples = 4; // milos, added - number of samples for averaging of arduino analog inputs
+#if defined(USE_ADC_SEQ) && !defined(ARDUINO_ARCH_RP2040)
+#define ADC_OSR_BITS 2 // extra bits of resolution from oversampling and decimation of analog inputs, 4^2 = 16x oversampling (max 3)
+#else // RP2040 ADC is already 12bit, samples are only averaged
+#define ADC_OSR_BITS 0
+#endif // end of adc seq
+#if defined(USE_ADC_SEQ) && defined(ARDUINO_ARCH_RP2040)
+#define ADC_DMA_BITS 8 // DMA ring of 2^8 samples shared by all pedal inputs
+#define ADC_DMA_LEN  (1 << ADC_DMA_BITS)
+#define ADC_DMA_RATE 128000L // conversions per second for all inputs together, ring holds exactly one control period (2ms)
+#endif // end of rp2040 adc dma
+#ifdef USE_AUTOCALIB
+// pedal limits track low and high percentile of pedal travel instead of raw min/max (frugal streaming quantile estimate)
+// high limit settles at 99.2th percentile of samples in upper half of the range and low limit at 0.8th percentile of samples in lower half
+#define AC_FRAC  12 // fractional bits of limit estimates
+#define AC_STEP  (1 << (AC_FRAC - 1)) // limit moves out by half a count per sample beyond it (10bit pot travel is learned in ~4s of pressing at 500Hz)
+#define AC_QBITS 7 // limit moves back in by AC_STEP >> AC_QBITS per sample inside it (~2 counts per second), settles where 1 in 129 samples is beyond it
+#endif // end of autocalib
+#ifdef USE_PEDAL_CURVES
+#define CURVE_POINTS 17 // points of pedal response curve, 16 linear segments over pedal travel
+#define CURVE_BITS   12
+#define CURVE_ONE    (1 << CURVE_BITS) // curve point value for full pedal output
+#endif // end of pedal curves
 // milos, default axis calibration values depend on usage of averaging or external ADC
 #ifdef AVG_INPUTS
 const uint16_t maxCal = 4095;
@@ -725,7 +843,6 @@ const uint16_t maxCal = 1023;
 #endif // end of avg inputs
 
 #ifdef USE_TCA9548 // milos, added
-#include <Wire.h> // milos, we need it here also
 // i2c address of TCA9548A i2c multiplexer chip (each chip has to have appropriate address bits configured)
 #define baseTCA0 0x70 // A0,A1,A2 = 000 // base addrress (there are 8)
 //          TCA1 0x71 // A0,A1,A2 = 100
@@ -735,12 +852,17 @@ const uint16_t maxCal = 1023;
 //          TCA5 0x75 // A0,A1,A2 = 101
 //          TCA6 0x76 // A0,A1,A2 = 011
 //          TCA7 0x77 // A0,A1,A2 = 111
+uint8_t tcaChannel = 0xFF; // currently selected i2C channel, 0xFF if unknown
+#ifndef USE_TWI_ASYNC // twi engine selects channel itself, see as5600Queue()
+#include <Wire.h> // milos, we need it here also
 // send to i2C info about which TCA chip and which i2C channel to select
 void TcaChannelSel(uint8_t addr, uint8_t ch) {
+  if (ch == tcaChannel) return; // already selected, save an i2C transaction
   Wire.beginTransmission(addr);
   Wire.write(1 << ch);
-  Wire.endTransmission();
+  tcaChannel = (Wire.endTransmission() == 0) ? ch : 0xFF;
 }
+#endif // end of twi async
 #endif // end of tca
 
 #endif // _CONFIG_H_
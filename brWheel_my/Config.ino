@@ -15,23 +15,23 @@ static inline void ensureEeprom() {
 }
 #endif
 
-void getParam (u16 offset, u8 *addr_to, u8 size) {
+void getParam (u16 offset, u8 *addr_to, u16 size) { // size is u16, cogging map is larger than 255 bytes
 #ifdef USE_EEPROM
 #if defined(ARDUINO_ARCH_RP2040)
   ensureEeprom();
 #endif
-  for (u8 i = 0; i < size; i++) {
+  for (u16 i = 0; i < size; i++) {
     addr_to[i] = EEPROM.read(offset + i);
   }
 #endif
 }
 
-void setParam (u16 offset, u8 *addr_to, u8 size) {
+void setParam (u16 offset, u8 *addr_to, u16 size) {
 #ifdef USE_EEPROM
 #if defined(ARDUINO_ARCH_RP2040)
   ensureEeprom();
 #endif
-  for (u8 i = 0; i < size; i++) {
+  for (u16 i = 0; i < size; i++) {
     //EEPROM.write(offset + i, addr_to[i]);
     EEPROM.update(offset + i, addr_to[i]); //milos, re-write only when neccessary
   }
@@ -115,6 +115,19 @@ void SetDefaultEEPROMConfig() { // milos - store default firmware settings in EE
   SetParam(PARAM_ADDR_CLUT_HI, v16);
   SetParam(PARAM_ADDR_HBRK_HI, v16);
 #endif // end of autocalib
+#ifdef USE_PEDAL_CURVES
+  for (u8 p = 0; p < 4; p++) linearCurve(p);
+  SetParam(PARAM_ADDR_PEDAL_CURVE, pedalCurves);
+#endif // end of pedal curves
+#ifdef USE_TORQUE_LUT
+  linearTorqueLut(); // min torque is not loaded yet, straight line from zero
+  SetParam(PARAM_ADDR_TORQUE_LUT, torqueLut);
+#endif // end of torque lut
+#ifdef USE_COGGING
+  cogClear();
+  SetParam(PARAM_ADDR_COG_MAP, cogMap);
+  SetParam(PARAM_ADDR_COG_FRIC, cogFric);
+#endif // end of cogging
 }
 
 void SetEEPROMConfig() { // milos, changed FIRMWARE_VERSION to 16bit from 32bit
@@ -177,6 +190,31 @@ void LoadEEPROMConfig () { //milos, added - updates all v8 parameters from EEPRO
   GetParam(PARAM_ADDR_HBRK_LO, hbrake.min);
   GetParam(PARAM_ADDR_HBRK_HI, hbrake.max);
 #endif
+#ifdef USE_PEDAL_CURVES
+  GetParam(PARAM_ADDR_PEDAL_CURVE, pedalCurves);
+  for (u8 p = 0; p < 4; p++) { // curves from older firmware (erased EEPROM) are out of range, start with linear ones
+    for (u8 k = 0; k < CURVE_POINTS; k++) {
+      if (pedalCurves[p][k] > CURVE_ONE) {
+        linearCurve(p);
+        break;
+      }
+    }
+  }
+#endif // end of pedal curves
+#ifdef USE_TORQUE_LUT
+  GetParam(PARAM_ADDR_TORQUE_LUT, torqueLut);
+  for (u8 k = 0; k < TORQUE_LUT_POINTS; k++) {
+    if (torqueLut[k] > TORQUE_LUT_ONE) { // not set yet, start with a straight line from min torque
+      linearTorqueLut();
+      break;
+    }
+  }
+#endif // end of torque lut
+#ifdef USE_COGGING
+  GetParam(PARAM_ADDR_COG_MAP, cogMap);
+  GetParam(PARAM_ADDR_COG_FRIC, cogFric);
+  if (cogFric == 0xFF) cogClear(); // not learned yet (erased EEPROM)
+#endif // end of cogging
 }
 
 void SaveEEPROMConfig () { //milos, added - saves all v8 parameters in EEPROM
@@ -218,6 +256,16 @@ void SaveEEPROMConfig () { //milos, added - saves all v8 parameters in EEPROM
   SetParam(PARAM_ADDR_HBRK_LO, hbrake.min);
   SetParam(PARAM_ADDR_HBRK_HI, hbrake.max);
 #endif
+#ifdef USE_PEDAL_CURVES
+  SetParam(PARAM_ADDR_PEDAL_CURVE, pedalCurves);
+#endif // end of pedal curves
+#ifdef USE_TORQUE_LUT
+  SetParam(PARAM_ADDR_TORQUE_LUT, torqueLut);
+#endif // end of torque lut
+#ifdef USE_COGGING
+  SetParam(PARAM_ADDR_COG_MAP, cogMap);
+  SetParam(PARAM_ADDR_COG_FRIC, cogFric);
+#endif // end of cogging
 }
 
 void ClearEEPROMConfig() { //milos, added - clears EEPROM (1KB on ATmega32U4)
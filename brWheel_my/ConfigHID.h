@@ -31,6 +31,8 @@ typedef struct {
 
 void configHID(USB_ConfigReport *data);
 
+extern uint8_t hidReportSent; // last HID_SendReport() was accepted by the endpoint (device configured)
+
 #if defined(ARDUINO_ARCH_RP2040)
 void HID_SendReport(uint8_t id, const void* data, int len);
 #endif
@@ -915,10 +915,11 @@ int WEAK HID_GetDescriptor(int i)
   return USB_SendControl(TRANSFER_PGM, _hidReportDescriptor, sizeof(_hidReportDescriptor));
 }
 
+u8 hidReportSent = 0;
+
 void WEAK HID_SendReport(u8 id, const void* data, int len)
 {
-  USB_Send(HID_TX, &id, 1);
-  USB_Send(HID_TX | TRANSFER_RELEASE, data, len);
+  hidReportSent = (USB_Send(HID_TX, &id, 1) > 0) && (USB_Send(HID_TX | TRANSFER_RELEASE, data, len) > 0); // USB_Send returns -1 if not configured
 }
 
 u8 WEAK HID_ReportAvailable()
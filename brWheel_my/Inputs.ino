@@ -27,9 +27,14 @@
 #include "debug.h"
 #include "USBDesc.h"
 #include <Arduino.h>
+#ifndef USE_TWI_ASYNC
 #include <Wire.h>
+#endif // end of twi async
 #include "fastio_compat.h"
 #include <HX711_ADC.h> // milos, credits to library creator Olav Kallhovd sept2017
+#ifdef USE_TWI_ASYNC
+#include "twi.h"
+#endif
 
 
 //--------------------------------------- Globals --------------------------------------------------------
@@ -64,14 +69,14 @@ u8 analog_inputs_pins[] = // milos, changed to u8, from u16
 
 u8 axis_shift_n_bits[] =  // milos, changed to u8, from u16
 {
-  Z_AXIS_NB_BITS - ADC_NB_BITS,
+  Z_AXIS_NB_BITS - (ADC_NB_BITS + ADC_OSR_BITS),
 #ifdef USE_LOAD_CELL //milos
-  RX_AXIS_NB_BITS - ADC_NB_BITS,
+  RX_AXIS_NB_BITS - (ADC_NB_BITS + ADC_OSR_BITS),
 #else
-  Y_AXIS_NB_BITS - (ADC_NB_BITS + 4), // milos, added - we scale it to 4095, that's why +4
-  RX_AXIS_NB_BITS - ADC_NB_BITS,
+  Y_AXIS_NB_BITS - (ADC_NB_BITS + ADC_OSR_BITS + 4), // milos, added - we scale it to 4095, that's why +4
+  RX_AXIS_NB_BITS - (ADC_NB_BITS + ADC_OSR_BITS),
 #endif
-  RY_AXIS_NB_BITS - ADC_NB_BITS
+  RY_AXIS_NB_BITS - (ADC_NB_BITS + ADC_OSR_BITS)
 };
 
 #ifdef AVG_INPUTS //milos, include this only if used
@@ -81,6 +86,80 @@ s32 analog_inputs[sizeof(analog_inputs_pins)];
 s8 nb_mes; // milos, changed from s32 to s8
 #endif
 
+#ifdef USE_ADC_SEQ
+#if defined(USE_XY_SHIFTER) && !defined(USE_PROMICRO)
+#define ADC_SEQ_NUM (sizeof(analog_inputs_pins) + 2) // shifter x and y are sampled after pedal inputs
+#else
+#define ADC_SEQ_NUM sizeof(analog_inputs_pins)
+#endif // end of xy shifter
+
+#if defined(ARDUINO_ARCH_RP2040)
+u16 adcDmaBuf[ADC_DMA_LEN] __attribute__((aligned(ADC_DMA_LEN * 2))); // DMA ring, slot k always holds round robin channel k % adcDmaStep
+u8 adcDmaSlot[ADC_SEQ_NUM]; // position of each input within one round robin pass
+u8 adcDmaStep; // number of channels in round robin pass (power of two, so passes stay aligned with the ring)
+u32 adcDmaCount = 0xFFFFFFFF; // reloaded into data channel by control channel, so capture never stops
+#else // if avr
+u8 adcSeqMux[ADC_SEQ_NUM]; // MUX2:0 and MUX5 bits for each sampled input, ready to be written to ADC registers
+u16 adcSeqSum[ADC_SEQ_NUM]; // sum of samples in current decimation block, only used in ADC interrupt
+volatile u16 adcSeqOut[ADC_SEQ_NUM]; // sum of last complete block, 2^(2*ADC_OSR_BITS) times the averaged 10bit input
+volatile u8 adcSeqCh = 0; // input that is being converted now
+u8 adcSeqCnt = 0; // samples of each input in current block, all inputs are sampled in the same round robin pass
+#endif // end of rp2040
+#endif
+
+#ifdef USE_LOAD_CELL
+s32 lcRaw[3]; // last three raw HX711 samples, for median filter
+u8 lcIdx = 0;
+s32 lcTare = 0; // zero offset
+s32 lcTareSum = 0;
+u8 lcTareCnt = 0; // samples left to collect for tare, 0 when tare is done
+b8 lcOn = false; // HX711 is only read after settling time, see lcStart()
+u32 lcMul; // brake scaling, 16.16 fixed point
+s32 lcVal = 0; // last filtered and scaled load cell value
+#endif // end of load cell
+
+#ifdef USE_ADS1015
+#define ADS_CONV_US 340 // us, 303us conversion at 3300SPS plus 10% margin for ADS1015 oscillator
+#define ADS_CFG_US  110 // us, config write that starts conversion (4 bytes at 400kHz)
+#define ADS_READ_US 140 // us, readout of previous result that follows config write in the same transfer (5 bytes at 400kHz)
+#ifdef USE_TWI_ASYNC // Adafruit_ADS1015.h pulls in Wire, so the few ADS1015 registers we use are defined here
+#define ADS1015_ADDRESS                 0x48
+#define ADS1015_REG_POINTER_CONVERT     0x00
+#define ADS1015_REG_POINTER_CONFIG      0x01
+#define ADS1015_REG_CONFIG_OS_SINGLE    0x8000
+#define ADS1015_REG_CONFIG_MUX_SINGLE_0 0x4000
+#define ADS1015_REG_CONFIG_PGA_4_096V   0x0200
+#define ADS1015_REG_CONFIG_MODE_SINGLE  0x0100
+#define ADS1015_REG_CONFIG_DR_3300SPS   0x00C0
+#define ADS1015_REG_CONFIG_CMODE_TRAD   0x0000
+#define ADS1015_REG_CONFIG_CPOL_ACTVLOW 0x0000
+#define ADS1015_REG_CONFIG_CLAT_NONLAT  0x0000
+#define ADS1015_REG_CONFIG_CQUE_NONE    0x0003
+#define ADS_GAIN ADS1015_REG_CONFIG_PGA_4_096V // 1x gain +/- 4.096V, 1 bit = 2mV (same as ads.setGain(GAIN_ONE) in setup without twi async)
+#else // if no twi async
+#define ADS_GAIN ads.getGain()
+#endif // end of twi async
+
+u8 ads_inputs[] = // ADS1015 inputs that are converted in sequence, one at a time
+{
+  ACCEL_INPUT,
+#ifndef USE_LOAD_CELL
+  BRAKE_INPUT,
+#endif // end of load cell
+  CLUTCH_INPUT,
+  HBRAKE_INPUT
+};
+s16 adsVal[4]; // last result of each ADS1015 input (single ended, 11bit)
+u8 adsIdx = 0; // index in ads_inputs of conversion in progress
+u32 adsStart = 0; // time when conversion in progress was started
+#ifdef USE_TWI_ASYNC
+u8 adsBuf[2]; // conversion register, filled by twi engine
+volatile u8 adsStatus = TWI_DONE; // result of last background transfer
+b8 adsPending = false; // true while next conversion start and result readout are on i2C bus
+b8 adsRestart = false; // last transfer failed, we don't know which input is converting, restart adsIdx without readout
+#endif // end of twi async
+#endif // end of ads1015
+
 //----------------------------------------- Options -------------------------------------------------------
 
 #ifdef USE_DSP56ADC16S
@@ -122,8 +201,55 @@ void InitADC () {
 void InitLoadCell () { // milos, added
   LoadCell.begin(); // milos
   LoadCell.setGain(); // milos - set gain for channel A, default is 128, available is 64 (32 - for channel B only)
-  LoadCell.start(2000); // milos, tare preciscion can be improved by adding a few seconds of stabilising time, (default 2000)
-  LoadCell.setCalFactor(0.25 * float(LC_scaling)); // user set calibration factor (float) // milos
+  lcSetScaling(LC_scaling); // user set calibration factor // milos
+  // no blocking LoadCell.start(), HX711 stabilises while boot task waits for LC_SETTLE_MS and then calls lcStart()
+}
+
+void lcStart() { // take tare, from here on HX711 is read by lcService()
+  lcTareStart();
+  lcOn = true;
+}
+
+// HX711 is read directly, without library update()/getData(), as soon as main loop sees DOUT low
+// raw samples go through a median of 3 filter (rejects single spikes), then they are scaled with a fixed point multiplier
+void lcSetScaling(u8 s) { // same scaling as library with calFactor 0.25*s, lcMul = 4/s in 16.16 fixed point
+  if (s == 0) s = 1;
+  lcMul = (0x40000UL + (s >> 1)) / s;
+}
+
+void lcTareStart() { // zero offset is taken as average of the next LC_TARE_SAMPLES samples
+  lcTareSum = 0;
+  lcTareCnt = LC_TARE_SAMPLES;
+  lcVal = 0;
+}
+
+void lcService() {
+  if (!lcOn) return; // still settling, brake stays at zero
+  if (digitalReadFast(LC_DOUT_PIN)) return; // conversion not ready yet
+  s32 v = 0;
+  for (u8 i = 0; i < 24; i++) { // MSB first, bit is valid after rising edge and stays until next one
+    digitalWriteFast(LC_SCK_PIN, HIGH);
+    delayMicroseconds(1); // HX711 needs SCK high for at least 0.2us (T3), back to back writes only give 125ns
+    digitalWriteFast(LC_SCK_PIN, LOW);
+    v <<= 1;
+    if (digitalReadFast(LC_DOUT_PIN)) v |= 1;
+  }
+  digitalWriteFast(LC_SCK_PIN, HIGH); // 25th pulse, channel A with gain 128 for next conversion
+  delayMicroseconds(1);
+  digitalWriteFast(LC_SCK_PIN, LOW);
+  if (v & 0x800000) v |= 0xFF000000; // 24bit two's complement to 32bit
+  lcRaw[lcIdx] = v;
+  if (++lcIdx >= 3) lcIdx = 0;
+  if (lcTareCnt > 0) { // tare also fills median window
+    lcTareSum += v;
+    if (--lcTareCnt == 0) lcTare = lcTareSum / LC_TARE_SAMPLES;
+    return;
+  }
+  s32 a = lcRaw[0];
+  s32 b = lcRaw[1];
+  s32 c = lcRaw[2];
+  s32 m = max(min(a, b), min(max(a, b), c)); // median of 3
+  lcVal = s32((int64_t(m - lcTare) * lcMul) >> 16);
 }
 #endif
 
@@ -154,6 +280,9 @@ void InitInputs() {
 
 #ifdef AVG_INPUTS //milos, include this only if used
   nb_mes = 0;
+#endif
+#ifdef USE_ADC_SEQ
+  InitAdcSeq();
 #endif
   // milos, re-map center button to TX pin (for the case where: no optical encoder, use as5600, use center button)
 #ifndef USE_QUADRATURE_ENCODER
@@ -176,14 +305,54 @@ short int SHIFTREG_STATE;
 u32 bytesVal_SHR; // milos, added - 32bit shift register input buffer for buttons
 u8 i;
 u8 bitVal; // milos, added - current bit readout from shift register
+#ifdef USE_SHIFTREG_SPI
+u8 shrBuf[SHIFTREG_BYTES]; // bytes of the frame clocked in by SPI interrupt
+volatile u8 shrIdx = SHIFTREG_BYTES; // index of byte on the wire, SHIFTREG_BYTES when frame is complete
+#endif // end of shift reg spi
+#ifdef USE_AUTOCALIB
+s32 acLo[4]; // low and high pedal limit estimates, with AC_FRAC fractional bits (accel, brake, clutch, hbrake)
+s32 acHi[4];
+u8 acSeeded = 0; // bit i is set once pedal i has its first sample
+#endif // end of autocalib
+#ifdef USE_BTNMATRIX
+u8 mxRow = 0; // matrix row currently pulled low
+u16 mxScan = 0; // rows read so far in current scan, 4 bits per row
+u16 mxImage = 0; // last complete scan with ghost keys filtered out
+u16 mxGhosts = 0; // number of scans with ambiguous (ghosting) key patterns since powerup
+#endif // end of button matrix
+#ifdef USE_DEBOUNCE
+u32 dbState = 0; // debounced button states
+u32 dbCnt[DEBOUNCE_BITS]; // vertical counter, bit n of dbCnt[k] is bit k of button n's counter
+#endif // end of debounce
+#ifdef USE_SHIFT_REGISTER
+u16 shrTime = 0; // us, time spent in readShiftRegister() during last control tick
+#endif // end of shift reg
 
 #if defined(ARDUINO_ARCH_RP2040)
 static inline bool readButtonPin(uint8_t pin) {
   return digitalRead(pin) == LOW;
 }
+#define readButton(k) readSingleButton(k)
+#else
+// button k is read straight from its port input register, pin and bit are known at compile time (BUTTONk, BkPORTBIT in Config.h)
+// so each button is a single PINx read and bit test, without function call and if chain of readSingleButton()
+#define readButton(k) (!bitRead(digitalReadFast(BUTTON##k), B##k##PORTBIT))
 #endif
 
 #ifdef USE_SHIFT_REGISTER
+void InitShiftRegister() {
+#ifdef USE_SHIFTREG_SPI
+  pinModeFast(SHIFTREG_PL, OUTPUT);
+  pinModeFast(SHIFTREG_CLK, OUTPUT);
+  pinModeFast(SHIFTREG_DATA_SW, INPUT);
+  DDRB |= _BV(0); // SS (PB0) must be an output, otherwise a low level on it would drop SPI out of master mode
+  SPCR = _BV(SPE) | _BV(MSTR) | _BV(DORD) | SHIFTREG_SPI_SPR; // master, mode 0 (sample on rising clock edge), LSB first as in bit banged version
+  SPSR = 0;
+  SPCR |= _BV(SPIE);
+  bytesVal_SHR = 0;
+  shrStart(); // first frame is ready by the first control tick
+}
+#else // bit banged
 void InitShiftRegister() {
   pinModeFast(SHIFTREG_CLK, OUTPUT); // milos, changed to fast
   pinModeFast(SHIFTREG_DATA_SW, INPUT); // milos, changed to fast
@@ -198,6 +367,7 @@ void InitShiftRegister() {
   i = 0;
   bitVal = 0; // milos, added
 }
+#endif // end of shift reg spi
 #else // no shift reg
 void InitButtons() { // milos, added - if not using shift register, allocate some free pins for buttons
   pinMode(BUTTON0, INPUT_PULLUP);
@@ -223,13 +393,13 @@ void InitButtons() { // milos, added - if not using shift register, allocate som
   pinModeFast(BUTTON4, OUTPUT);
   pinModeFast(BUTTON5, OUTPUT);
   pinModeFast(BUTTON6, OUTPUT);
-  setMatrixRow(BUTTON4, HIGH);
-  setMatrixRow(BUTTON5, HIGH);
-  setMatrixRow(BUTTON6, HIGH);
+  setMatrixRow(1, HIGH);
+  setMatrixRow(2, HIGH);
 #ifndef USE_LOAD_CELL
   pinModeFast(BUTTON7, OUTPUT);
-  setMatrixRow(BUTTON7, HIGH);
+  setMatrixRow(3, HIGH);
 #endif // end of load cell
+  setMatrixRow(0, LOW); // first row is selected, matrixService() reads it on next main loop pass
 #endif // end of button matrix
 #ifdef USE_EXTRABTN
   pinMode(BUTTON8, INPUT_PULLUP);
@@ -294,6 +464,49 @@ void nextInputState() {
   }
   SHIFTREG_STATE++;
 }
+
+#ifdef USE_SHIFTREG_SPI
+void shrStart() { // latch buttons and clock the first byte out, SPI interrupt takes care of the rest
+#ifndef USE_SN74ALS166N
+  digitalWriteFast(SHIFTREG_PL, HIGH); // nano button box protocol, same as bit banged version
+  digitalWriteFast(SHIFTREG_PL, LOW);
+#else // with shift register chip(s), parallel load needs a rising clock edge while PL is low
+  digitalWriteFast(SHIFTREG_PL, LOW);
+  SPCR &= ~_BV(SPE); // hand SCK pin back to PORTB for one manual clock pulse
+  digitalWriteFast(SHIFTREG_CLK, HIGH);
+  digitalWriteFast(SHIFTREG_CLK, LOW);
+  SPCR |= _BV(SPE);
+  digitalWriteFast(SHIFTREG_PL, HIGH);
+#endif // end of sn74
+  shrIdx = 0;
+  SPDR = 0;
+}
+
+ISR(SPI_STC_vect) { // byte is in, start the next one right away
+  shrBuf[shrIdx++] = SPDR;
+  if (shrIdx < SHIFTREG_BYTES) SPDR = 0;
+}
+#endif // end of shift reg spi
+
+void readShiftRegister() { // refresh bytesVal_SHR with a full frame of the shift register chain
+#ifdef USE_SHIFTREG_SPI
+  if (shrIdx < SHIFTREG_BYTES) return; // frame still on the wire (SPI clock too slow for control period), keep last buttons
+  u32 v = 0;
+  for (u8 k = 0; k < SHIFTREG_BYTES; k++) {
+#ifndef USE_SN74ALS166N
+    v |= (u32)shrBuf[k] << (8 * k);
+#else
+    v |= (u32)(u8)~shrBuf[k] << (8 * k); // invert the buttons
+#endif // end of sn74
+  }
+  bytesVal_SHR = v;
+  shrStart(); // next frame is clocked in while the firmware does other work
+#else // bit banged, one pin toggle per call
+  for (u8 k = 0; k <= SHIFTS_NUM; k++) { // milos, read all states in one pass
+    nextInputState();  // milos, refresh state of shift register and read the next incoming bit
+  }
+#endif // end of shift reg spi
+}
 #endif
 
 u32 readInputButtons() {
@@ -333,9 +546,9 @@ u32 readInputButtons() {
 #else  // milos, when no shift reg, use Arduino Leonardo for 3 or 4 buttons
 #ifndef USE_BTNMATRIX // milos, added - read all available buttons only if we are not using button matrix
   // milos, here we define button mappings (link between arduino pins and buttons defined in HID)
-  bitWrite(buttons, 0, readSingleButton(0)); // milos, first 0 is button bit in HID, second 0 in brackets is associated to arduino pin - see config.h)
-  bitWrite(buttons, 1, readSingleButton(1));
-  bitWrite(buttons, 2, readSingleButton(2));
+  bitWrite(buttons, 0, readButton(0)); // milos, first 0 is button bit in HID, second 0 in brackets is associated to arduino pin - see config.h)
+  bitWrite(buttons, 1, readButton(1));
+  bitWrite(buttons, 2, readButton(2));
   //------------- milos, start button3 case
 #ifdef USE_PROMICRO // milos, for proMicro button3 on D3 is available only if not using zindex and i2C devices
 #ifdef USE_ZINDEX
@@ -358,32 +571,32 @@ u32 readInputButtons() {
 #ifndef USE_AS5600
 #ifndef USE_ADS1015
 #ifndef USE_MCP4725
-  bitWrite(buttons, 3, readSingleButton(3));   // milos, we can have button3 on D3 on proMicro only if nothing is using pin D3
+  bitWrite(buttons, 3, readButton(3));   // milos, we can have button3 on D3 on proMicro only if nothing is using pin D3
 #endif // end of z-index
 #endif // end of as5600
 #endif // end of ads1015
 #endif // end of mcp4725
 #else // milos, if we use Leonardo or Micro we can have button3 on D12 even with z-index and i2C devices
-  bitWrite(buttons, 3, readSingleButton(3));
+  bitWrite(buttons, 3, readButton(3));
 #endif // end of pro micro
-  bitWrite(buttons, 4, readSingleButton(4));
-  bitWrite(buttons, 5, readSingleButton(5));
-  bitWrite(buttons, 6, readSingleButton(6));
+  bitWrite(buttons, 4, readButton(4));
+  bitWrite(buttons, 5, readButton(5));
+  bitWrite(buttons, 6, readButton(6));
 #ifndef USE_LOAD_CELL // milos, when no load cell
 #ifndef USE_AS5600 // milos, when not using as5600 we can have button7 at pin D5
 #ifndef USE_TWOFFBAXIS // milos, when not using 2 FFB axis, 2nd PWM channel
-  bitWrite(buttons, 7, readSingleButton(7));
+  bitWrite(buttons, 7, readButton(7));
 #else // with 2ffb axis, D5 is used by timer3 for PWM output
   bitWrite(buttons, 7, 0); // milos, we don't have button7
 #endif // end of 2 ffb axis
 #else // milos, if we use mag encoder and hat switch on proMicro
 #ifdef USE_PROMICRO
 #ifdef USE_HATSWITCH
-  bitWrite(buttons, 3, readSingleButton(7)); // milos, we need to remap D6 to button3 in order for hat switch left to work
+  bitWrite(buttons, 3, readButton(7)); // milos, we need to remap D6 to button3 in order for hat switch left to work
   bitWrite(buttons, 7, 0); // milos, we don't have button7 (pin D5) in that case
 #endif // end of hat swich
 #else // for leonardo/micro with hat switch
-  bitWrite(buttons, 7, readSingleButton(7)); // milos, button7 is on pin D5 for leonardo/micro with hat switch
+  bitWrite(buttons, 7, readButton(7)); // milos, button7 is on pin D5 for leonardo/micro with hat switch
 #endif // end of proMicro
 #endif // end of as5600
 #else // milos, with load cell
@@ -391,8 +604,8 @@ u32 readInputButtons() {
 #endif // end of 
 
 #ifdef USE_EXTRABTN
-  bitWrite(buttons, 8, readSingleButton(8));
-  bitWrite(buttons, 9, readSingleButton(9));
+  bitWrite(buttons, 8, readButton(8));
+  bitWrite(buttons, 9, readButton(9));
 #endif // end of extra button
 #else // do matrix button readout
   // buttons 0-3 of are columns j
@@ -403,16 +616,15 @@ u32 readInputButtons() {
   // D7 |b21 b22 b23 b24|
   // D8 |b31 b32 b33 b34|
   // D5 |b41 b42 b43 b44|
-  for (uint8_t i = 0; i < 4; i++) { // rows (along X), we set each row high, one at a time
-    setMatrixRow (i, LOW);
-    for (uint8_t j = 0; j < 4; j++) { // columns (along Y), read each button from that row by scanning over columns
-      bitWrite(buttons, i * 4 + j, readSingleButton(j));
-    }
-    setMatrixRow (i, HIGH);
-  }
+  // rows are scanned one per main loop pass by matrixService(), here we only take the last complete scan
+  buttons = mxImage;
 #endif // end of button matrix
 #endif // end of shift reg
 
+#ifdef USE_DEBOUNCE
+  buttons = debounceButtons(buttons);
+#endif // end of debounce
+
 #ifdef USE_HATSWITCH // milos, added
   buttons = decodeHat(buttons); // milos, decodes hat switch values into only 1st 4 buttons (button0-up, button1-right, button2-down, button3-left)
 #else
@@ -422,9 +634,8 @@ u32 readInputButtons() {
   return (buttons); // milos, we send all 4 bytes
 }
 
-#ifndef USE_SHIFT_REGISTER
+#if !defined(USE_SHIFT_REGISTER) && defined(ARDUINO_ARCH_RP2040)
 bool readSingleButton (uint8_t i) { // milos, added
-#if defined(ARDUINO_ARCH_RP2040)
   switch (i) {
     case 0: return readButtonPin(BUTTON0);
     case 1: return readButtonPin(BUTTON1);
@@ -442,37 +653,6 @@ bool readSingleButton (uint8_t i) { // milos, added
 #endif
     default: return false;
   }
-#else
-  bool temp;
-  if (i == 0) {
-    temp = !bitRead(digitalReadFast(BUTTON0), B0PORTBIT); // milos, read bit4 from PINF A3 (or bit4 from PIND D4 when no LC, or bit6 from PINC D5 on leonardo/micro when XY shifter) into buttons bit0
-  } else if (i == 1) {
-    temp = !bitRead(digitalReadFast(BUTTON1), B1PORTBIT); // milos, read bit1 from PINF A4 (or bit3 from PINB D14 on ProMicro) into buttons bit1
-  } else if (i == 2) {
-    temp = !bitRead(digitalReadFast(BUTTON2), B2PORTBIT); // milos, read bit0 from PINF A5 (or bit1 from PINB D15 on ProMicro) into buttons bit2
-  } else if (i == 3) {
-    temp = !bitRead(digitalReadFast(BUTTON3), B3PORTBIT); // milos, read bit6 from PIND D12 into buttons bit3
-  } else if (i == 4) {
-    temp = !bitRead(digitalReadFast(BUTTON4), B4PORTBIT); // milos, read bit7 from PIND D6 into buttons bit4
-  } else if (i == 5) {
-    temp = !bitRead(digitalReadFast(BUTTON5), B5PORTBIT); // milos, read bit6 from PINE D7 into buttons bit5
-  } else if (i == 6) {
-    temp = !bitRead(digitalReadFast(BUTTON6), B6PORTBIT); // milos, read bit4 from PINB D8 into buttons bit6
-#ifndef USE_LOAD_CELL // milos, save some memory space if this button is unavailable
-  } else if (i == 7) {
-    temp = !bitRead(digitalReadFast(BUTTON7), B7PORTBIT); // milos, read bit6 from PINC D5 into buttons bit7
-#endif // end of load cell
-#ifdef USE_EXTRABTN // milos, if enabled we have 2 more extra digital buttons
-  } else if (i == 8) {
-    temp = !bitRead(digitalReadFast(BUTTON8), B8PORTBIT); // milos, read bit5 from PINF A2 into buttons bit8
-  } else if (i == 9) {
-    temp = !bitRead(digitalReadFast(BUTTON9), B9PORTBIT); // milos, read bit4 from PINF A3 into buttons bit9
-#endif // end of extra button
-  } else {
-    temp = false;
-  }
-  return temp;
-#endif
 }
 #endif // end of shift register
 
@@ -488,10 +668,267 @@ void setMatrixRow (uint8_t j, uint8_t k) { // milos, added
     digitalWriteFast(BUTTON7, k);
   }
 }
+
+// rows (along X) are pulled low one at a time, row selected on previous main loop pass has had the whole pass to settle,
+// so there is no delay here and each call costs the same, one row read and one row switch
+void matrixService() {
+  u16 row = readButton(0) | (readButton(1) << 1) | (readButton(2) << 2) | (readButton(3) << 3); // columns (along Y), all buttons of that row at once
+  mxScan |= row << (mxRow * 4);
+  setMatrixRow(mxRow, HIGH);
+  if (++mxRow >= 4) { // full scan done
+    mxRow = 0;
+    u16 amb = matrixGhosts(mxScan);
+    if (amb) mxGhosts++;
+    mxImage = (mxScan & ~amb) | (mxImage & amb); // ambiguous keys keep their last state, phantom presses are not reported
+    mxScan = 0;
+  }
+  setMatrixRow(mxRow, LOW);
+}
+
+// without diodes, three pressed corners of a rectangle (two rows, two columns) make the fourth one read as pressed too,
+// so when two rows share two or more pressed columns we can not tell which of those keys are real
+u16 matrixGhosts(u16 scan) {
+  u16 amb = 0;
+  for (u8 a = 0; a < 3; a++) {
+    for (u8 b = a + 1; b < 4; b++) {
+      u8 c = (scan >> (a * 4)) & (scan >> (b * 4)) & 0x0F; // columns pressed in both rows
+      if (c & (c - 1)) amb |= ((u16)c << (a * 4)) | ((u16)c << (b * 4)); // at least two of them
+    }
+  }
+  return amb;
+}
 #endif // end of button matrix
 
 //--------------------------------------------------------------------------------------------------------
 
+#ifdef USE_ADC_SEQ
+#if defined(ARDUINO_ARCH_RP2040)
+// ADC free runs in round robin mode over all pedal channels and DMA drains its FIFO into a ring buffer, CPU never waits for a conversion,
+// ring holds ADC_DMA_LEN/adcDmaStep samples of every input (one control period at ADC_DMA_RATE), they are only summed up when the tick reads them
+// DMA can not run forever on RP2040, so a second channel chained to the data channel reloads its transfer count and retriggers it
+void InitAdcSeq() {
+  u8 mask = 0;
+  for (u8 i = 0; i < ADC_SEQ_NUM; i++) {
+    adc_gpio_init(analog_inputs_pins[i]);
+    mask |= 1 << (analog_inputs_pins[i] - 26); // GPIO26-29 are ADC inputs 0-3
+  }
+  for (u8 ch = 0; ch < 5 && (__builtin_popcount(mask) & (__builtin_popcount(mask) - 1)); ch++) {
+    mask |= 1 << ch; // pad pass to power of two with unused channels (input 4 is temperature sensor), their samples are ignored
+  }
+  adcDmaStep = __builtin_popcount(mask);
+  for (u8 i = 0; i < ADC_SEQ_NUM; i++) {
+    adcDmaSlot[i] = __builtin_popcount(mask & ((1 << (analog_inputs_pins[i] - 26)) - 1)); // channels are converted in ascending order
+  }
+  adc_init();
+  adc_select_input(__builtin_ctz(mask)); // first conversion is from the lowest channel, so it lands in slot 0
+  adc_set_round_robin(mask);
+  adc_fifo_setup(true, true, 1, false, false); // DREQ on every sample, no error bit, full 12bit samples
+  adc_set_clkdiv(48000000.0f / ADC_DMA_RATE - 1.0f); // one conversion every 1+div cycles of 48MHz ADC clock
+  adc_fifo_drain();
+
+  int data = dma_claim_unused_channel(true);
+  int ctrl = dma_claim_unused_channel(true);
+  dma_channel_config c = dma_channel_get_default_config(data);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+  channel_config_set_read_increment(&c, false);
+  channel_config_set_write_increment(&c, true);
+  channel_config_set_ring(&c, true, ADC_DMA_BITS + 1); // wrap write address at ring size in bytes
+  channel_config_set_dreq(&c, DREQ_ADC);
+  channel_config_set_chain_to(&c, ctrl);
+  dma_channel_configure(data, &c, adcDmaBuf, &adc_hw->fifo, adcDmaCount, false);
+  c = dma_channel_get_default_config(ctrl);
+  channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+  channel_config_set_read_increment(&c, false);
+  channel_config_set_write_increment(&c, false);
+  dma_channel_configure(ctrl, &c, &dma_hw->ch[data].al1_transfer_count_trig, &adcDmaCount, 1, false);
+  dma_channel_start(data);
+  adc_run(true);
+  delayMicroseconds(ADC_DMA_LEN * 1000000L / ADC_DMA_RATE + 100); // let the ring fill up once, so there is no ramp up after powerup
+}
+
+s32 adcSeqTake(u8 i, u8 shift) { // boxcar average of input i over the whole ring, ADC_NB_BITS+ADC_OSR_BITS bits, scaled up by shift bits
+  u32 sum = 0;
+  for (u16 k = adcDmaSlot[i]; k < ADC_DMA_LEN; k += adcDmaStep) {
+    sum += adcDmaBuf[k]; // DMA keeps writing, we may get a few samples that are newer than the rest
+  }
+  return s32((sum * adcDmaStep) >> (ADC_DMA_BITS - ADC_OSR_BITS)) << shift;
+}
+#else // if avr
+// ADC runs all the time, each conversion complete interrupt stores the result and starts the next input in sequence
+// single conversions are chained from interrupt instead of free running mode, so mux is always switched before conversion starts
+// every input has a boxcar (first order CIC) decimator, N = 4^ADC_OSR_BITS (16 for 2 extra bits) samples are summed and the sum is
+// published as one output, control tick drops ADC_OSR_BITS of it, what is left are 10+ADC_OSR_BITS bits of averaged (noise dithered) input
+// latency: a new output comes every N passes of the sequence (N*ADC_SEQ_NUM*104us, 6.7ms for 16x and 4 inputs), it is the average
+// of that block, so it lags the input by half a block plus up to one block until it is read
+void InitAdcSeq() {
+  for (u8 i = 0; i < ADC_SEQ_NUM; i++) {
+    u8 pin;
+#if defined(USE_XY_SHIFTER) && !defined(USE_PROMICRO)
+    if (i == sizeof(analog_inputs_pins)) {
+      pin = SHIFTER_X_PIN;
+    } else if (i > sizeof(analog_inputs_pins)) {
+      pin = SHIFTER_Y_PIN;
+    } else {
+      pin = analog_inputs_pins[i];
+    }
+#else
+    pin = analog_inputs_pins[i];
+#endif // end of xy shifter
+    adcSeqOut[i] = analogRead(pin) << (2 * ADC_OSR_BITS); // start from the current input value, so first block does not read as zero
+    adcSeqSum[i] = 0;
+    if (pin >= 18) pin -= 18; // same pin to channel mapping as in analogRead()
+    pin = analogPinToChannel(pin);
+    adcSeqMux[i] = (pin & 0x07) | (((pin >> 3) & 0x01) << MUX5);
+  }
+  adcSeqCh = 0;
+  adcSeqCnt = 0;
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | (adcSeqMux[0] & _BV(MUX5));
+  ADMUX = (DEFAULT << 6) | (adcSeqMux[0] & 0x07); // AVcc reference, like analogRead()
+  ADCSRA |= _BV(ADIE) | _BV(ADSC); // keep prescaler from core init (125kHz ADC clock, 104us per conversion)
+}
+
+ISR(ADC_vect) {
+  u8 ch = adcSeqCh;
+  u16 s = adcSeqSum[ch] + ADC; // 16bit sum, max 1023*64 for 64x oversampling
+  if (adcSeqCnt == (1 << (2 * ADC_OSR_BITS)) - 1) { // block complete, publish it and start the next one
+    adcSeqOut[ch] = s;
+    s = 0;
+  }
+  adcSeqSum[ch] = s;
+  if (++ch >= ADC_SEQ_NUM) {
+    ch = 0;
+    if (++adcSeqCnt >= (1 << (2 * ADC_OSR_BITS))) adcSeqCnt = 0;
+  }
+  adcSeqCh = ch;
+  u8 m = adcSeqMux[ch];
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | (m & _BV(MUX5));
+  ADMUX = (ADMUX & 0xE0) | (m & 0x07);
+  ADCSRA |= _BV(ADSC);
+}
+
+s32 adcSeqTake(u8 i, u8 shift) { // decimated input i, 10+ADC_OSR_BITS bits, scaled up by shift bits
+  u16 acc;
+  noInterrupts(); // 16bit value is updated from ADC interrupt
+  acc = adcSeqOut[i];
+  interrupts();
+  return s32(acc >> ADC_OSR_BITS) << shift;
+}
+#endif // end of rp2040
+
+#if defined(USE_XY_SHIFTER) && !defined(USE_PROMICRO)
+u16 adcSeqShifter(u8 axis) { // 10bit shifter axis, 0-x, 1-y
+  return adcSeqTake(sizeof(analog_inputs_pins) + axis, 0) >> ADC_OSR_BITS;
+}
+#endif // end of xy shifter
+#endif // end of adc seq
+
+#ifdef USE_ADS1015
+// pedals are converted one by one in single shot mode, adsService() is polled from main loop and once the conversion in progress is done
+// it starts conversion of the next input and then reads the previous result (conversion register keeps it until the new conversion is done,
+// so readout overlaps the conversion), with twi async the transfer runs in the background and one input takes about 450us
+// (250us on i2C bus, 200us waiting), all pedals are refreshed every 1.8ms with 4 inputs (1.35ms with load cell) and pedal values
+// are just taken from adsVal[] at the control tick (ALERT/RDY pin is not used, there is no spare interrupt pin for it on every board)
+u16 adsConfig(u8 ch) { // config register value that starts single conversion of input ch
+  return ADS1015_REG_CONFIG_CQUE_NONE | ADS1015_REG_CONFIG_CLAT_NONLAT | ADS1015_REG_CONFIG_CPOL_ACTVLOW |
+         ADS1015_REG_CONFIG_CMODE_TRAD | ADS1015_REG_CONFIG_DR_3300SPS | ADS1015_REG_CONFIG_MODE_SINGLE |
+         ADS_GAIN | (ADS1015_REG_CONFIG_MUX_SINGLE_0 + (u16(ch) << 12)) | ADS1015_REG_CONFIG_OS_SINGLE;
+}
+
+#ifdef USE_TWI_ASYNC
+b8 adsQueueConv(u8 ch) { // add conversion start of input ch to twi queue
+  u16 cfg = adsConfig(ch);
+  twiJob *j = twiNewJob(ADS1015_ADDRESS);
+  if (j == NULL) return false;
+  j->wbuf[0] = ADS1015_REG_POINTER_CONFIG;
+  j->wbuf[1] = cfg >> 8;
+  j->wbuf[2] = cfg & 0xFF;
+  j->nw = 3;
+  return true;
+}
+
+void InitAds() {
+  adsIdx = 0;
+  if (adsQueueConv(ads_inputs[0])) {
+    twiGo(&adsStatus);
+    twiWait(&adsStatus);
+  }
+  adsRestart = (adsStatus != TWI_DONE);
+  adsStart = micros();
+}
+
+b8 adsCollect() { // take the result once background transfer is done, returns false if it is still on i2C bus
+  if (!adsPending) return true;
+  if (adsStatus == TWI_PENDING) return false;
+  adsPending = false;
+  adsStart = micros(); // conversion was started by config write, before the readout
+  if (adsStatus == TWI_FAILED) {
+    adsRestart = true; // conversion start may or may not have gone through
+  } else if (adsRestart) {
+    adsRestart = false; // adsIdx is converting again
+  } else {
+    adsStart -= ADS_READ_US;
+    adsVal[ads_inputs[adsIdx]] = s16((adsBuf[0] << 8) | adsBuf[1]) >> 4;
+    if (++adsIdx >= sizeof(ads_inputs)) adsIdx = 0; // its conversion was started by this transfer
+  }
+  return true;
+}
+#else // if no twi async
+void adsStartConv(u8 ch) {
+  u16 cfg = adsConfig(ch);
+  Wire.beginTransmission(ADS1015_ADDRESS);
+  Wire.write(ADS1015_REG_POINTER_CONFIG);
+  Wire.write(cfg >> 8);
+  Wire.write(cfg & 0xFF);
+  Wire.endTransmission();
+}
+
+void InitAds() {
+  Wire.setClock(400000L); // ADS1015 supports fast mode i2C
+  adsIdx = 0;
+  adsStartConv(ads_inputs[0]);
+  adsStart = micros();
+}
+#endif // end of twi async
+
+void adsService() {
+#ifdef USE_TWI_ASYNC
+  if (!adsCollect()) return;
+  if ((micros() - adsStart) < ADS_CONV_US) return;
+  if (twiFree() < 2) return; // both jobs must fit, try again from next loop pass
+  u8 next = adsIdx;
+  if (!adsRestart && ++next >= sizeof(ads_inputs)) next = 0;
+  if (!adsQueueConv(ads_inputs[next])) return; // not reached, twiFree() check above guarantees room for both jobs
+  if (!adsRestart) {
+    twiJob *j = twiNewJob(ADS1015_ADDRESS); // read result of adsIdx, still there while next one converts
+    if (j != NULL) {
+      j->wbuf[0] = ADS1015_REG_POINTER_CONVERT;
+      j->nw = 1;
+      j->nr = 2;
+      j->rbuf = adsBuf;
+    } else { // not reached, drop this result and go on with the one that is started now
+      adsIdx = next;
+      adsRestart = true;
+    }
+  }
+  twiGo(&adsStatus); // may wait in the queue behind other batches, adsStart is taken when it is done
+  adsPending = true;
+#else // if no twi async
+  if ((micros() - adsStart) < ADS_CFG_US + ADS_CONV_US) return;
+  u8 next = (adsIdx + 1 < sizeof(ads_inputs)) ? adsIdx + 1 : 0;
+  adsStart = micros();
+  adsStartConv(ads_inputs[next]);
+  Wire.beginTransmission(ADS1015_ADDRESS);
+  Wire.write(ADS1015_REG_POINTER_CONVERT);
+  Wire.endTransmission();
+  Wire.requestFrom((u8)ADS1015_ADDRESS, (u8)2);
+  u8 hi = Wire.read();
+  u8 lo = Wire.read();
+  adsVal[ads_inputs[adsIdx]] = s16((hi << 8) | lo) >> 4;
+  adsIdx = next;
+#endif // end of twi async
+}
+#endif // end of ads1015
+
 #ifdef AVG_INPUTS //milos, include this only if it is used
 void ClearAnalogInputs() {
   for (u8 i = 0; i < sizeof(analog_inputs_pins); i++) {
@@ -511,7 +948,257 @@ void ReadAnalogInputs() { // milos, changed to void from uint16_t
 
 void AverageAnalogInputs() {
   for (u8 i = 0; i < sizeof(analog_inputs_pins); i++) {
+#ifdef USE_ADC_SEQ
+    analog_inputs[i] = adcSeqTake(i, axis_shift_n_bits[i]); // samples are already oversampled and filtered by ADC interrupt
+#else // if no adc seq
     analog_inputs[i] = (analog_inputs[i] << axis_shift_n_bits[i]) / nb_mes; //milos, fixed
+#endif // end of adc seq
+  }
+}
+#endif
+
+//--------------------------------------------------------------------------------------------------------
+
+#ifdef USE_AS5600
+#ifdef USE_TWI_ASYNC
+// angles are read in the background by twi engine, cumulative position is tracked here the same way as in AS5600 library
+#define AS5600_ADDR      0x36
+#define AS5600_CONF      0x07
+#define AS5600_RAW_ANGLE 0x0C
+
+u8 as5600Raw[AS5600_NUM][2]; // raw angle bytes, filled by twi engine
+s16 as5600Last[AS5600_NUM]; // last raw angle
+s32 as5600Cum[AS5600_NUM]; // cumulative position
+volatile u8 as5600Status = TWI_DONE; // result of last background read
+u8 as5600Pending = 0; // bitmask of sensors that are being read in the background
+u8 as5600Fresh = 0; // bitmask of sensors with new raw angle that is not yet tracked
+u8 as5600Seen = 0; // bitmask of sensors that have given at least one angle
+u16 as5600Stale = 0; // number of position reads that found no new angle and kept the last one
+
+b8 as5600Queue(u8 ch) { // add raw angle read of sensor ch to twi queue, false if queue is full
+  twiJob *j;
+#ifdef USE_TCA9548
+  if (ch != tcaChannel) {
+    j = twiNewJob(baseTCA0);
+    if (j == NULL) return false;
+    j->wbuf[0] = 1 << ch;
+    j->nw = 1;
+    tcaChannel = ch;
+  }
+#endif // end of tca
+  j = twiNewJob(AS5600_ADDR);
+  if (j == NULL) return false; // no fresh angle, as5600Pos() keeps last position
+  j->wbuf[0] = AS5600_RAW_ANGLE;
+  j->nw = 1;
+  j->nr = 2;
+  j->rbuf = as5600Raw[ch];
+  as5600Pending |= 1 << ch;
+  return true;
+}
+
+void as5600Prefetch() { // start reading all sensors, begin with the one that mux is already set to (saves one mux write)
+  if (as5600Pending) return; // already on its way, or done and not yet taken by control tick
+#ifdef USE_TCA9548
+  u8 first = (tcaChannel < AS5600_NUM) ? tcaChannel : 0;
+#else
+  u8 first = 0;
+#endif // end of tca
+  for (u8 i = 0; i < AS5600_NUM; i++) {
+    if (!as5600Queue((first + i) % AS5600_NUM)) break;
+  }
+  if (as5600Pending) twiGo(&as5600Status);
+}
+
+void as5600Collect() { // take background reads that are done, never waits
+  if (!as5600Pending || as5600Status == TWI_PENDING) return;
+  if (as5600Status == TWI_DONE) {
+    as5600Fresh |= as5600Pending;
+  } else {
+#ifdef USE_TCA9548
+    tcaChannel = 0xFF; // we don't know where mux ended up
+#endif // end of tca
+  }
+  as5600Pending = 0;
+}
+
+void as5600ReadNow(u8 ch) { // blocking read of one angle, for setup and serial commands
+  if (as5600Pending) twiWait(&as5600Status);
+  as5600Collect();
+  if (as5600Queue(ch)) {
+    twiGo(&as5600Status);
+    twiWait(&as5600Status);
+    as5600Collect();
+  }
+}
+
+void as5600Init(u8 ch) { // turn off slow and fast filter of sensor ch (what setSlowFilter(0) and setFastFilter(0) of AS5600 library do) and take its first angle
+  u8 conf[2];
+  twiJob *j;
+#ifdef USE_TCA9548
+  j = twiNewJob(baseTCA0);
+  if (j == NULL) return;
+  j->wbuf[0] = 1 << ch;
+  j->nw = 1;
+  tcaChannel = ch;
+#endif // end of tca
+  j = twiNewJob(AS5600_ADDR);
+  if (j == NULL) return;
+  j->wbuf[0] = AS5600_CONF;
+  j->nw = 1;
+  j->nr = 2;
+  j->rbuf = conf;
+  twiGo(&as5600Status);
+  twiWait(&as5600Status);
+  if (as5600Status == TWI_DONE) {
+    j = twiNewJob(AS5600_ADDR);
+    if (j == NULL) return;
+    j->wbuf[0] = AS5600_CONF;
+    j->wbuf[1] = conf[0] & 0xE0; // FTH and SF bits at 0
+    j->wbuf[2] = conf[1];
+    j->nw = 3;
+    twiGo(&as5600Status);
+    twiWait(&as5600Status);
+  }
+  if (as5600Status != TWI_DONE) {
+#ifdef USE_TCA9548
+    tcaChannel = 0xFF;
+#endif // end of tca
+  }
+  as5600Reset(ch, ROTATION_MID);
+}
+
+s16 as5600RawAngle(u8 ch) {
+  return ((as5600Raw[ch][0] << 8) | as5600Raw[ch][1]) & 0x0FFF;
+}
+
+s32 as5600Pos(u8 ch) { // cumulative position of sensor ch, never waits for i2C bus, keeps last position if there is no new angle
+  if (ch >= AS5600_NUM) return 0;
+  as5600Collect();
+  if (!(as5600Fresh & (1 << ch))) { // prefetch did not make it (or failed), next one is started before next tick
+    as5600Stale++;
+    return as5600Cum[ch];
+  }
+  as5600Fresh &= ~(1 << ch);
+  s16 value = as5600RawAngle(ch);
+  s16 last = as5600Last[ch];
+  if ((last > 2048) && (value < (last - 2048))) { // whole rotation CW
+    as5600Cum[ch] += 4096 - last + value;
+  } else if ((value > 2048) && (last < (value - 2048))) { // whole rotation CCW
+    as5600Cum[ch] += value - last - 4096;
+  } else {
+    as5600Cum[ch] += value - last;
+  }
+  as5600Last[ch] = value;
+  return as5600Cum[ch];
+}
+
+s32 as5600Reset(u8 ch, s32 pos) { // set new cumulative position of sensor ch, returns the old one
+  if (ch >= AS5600_NUM) return 0;
+  if (!(as5600Seen & (1 << ch))) { // first angle of this sensor is read right away (setup), later resets just go on from last angle
+    as5600ReadNow(ch);
+    if (as5600Fresh & (1 << ch)) {
+      as5600Fresh &= ~(1 << ch);
+      as5600Last[ch] = as5600RawAngle(ch);
+      as5600Seen |= 1 << ch;
+    }
+  } else if (as5600Fresh & (1 << ch)) {
+    as5600Pos(ch); // track angle that is already here before we move the position
   }
+  s32 old = as5600Cum[ch];
+  as5600Cum[ch] = pos;
+  return old;
 }
+#else // if no twi async
+s32 as5600Pos(u8 ch) {
+#ifdef USE_TCA9548
+  TcaChannelSel(baseTCA0, ch);
+#endif // end of tca
+#if AS5600_NUM > 1
+  if (ch) return as5600y.getCumulativePosition();
 #endif
+  return as5600x.getCumulativePosition();
+}
+
+s32 as5600Reset(u8 ch, s32 pos) {
+#ifdef USE_TCA9548
+  TcaChannelSel(baseTCA0, ch);
+#endif // end of tca
+#if AS5600_NUM > 1
+  if (ch) return as5600y.resetCumulativePosition(pos);
+#endif
+  return as5600x.resetCumulativePosition(pos);
+}
+#endif // end of twi async
+#endif // end of as5600
+
+#ifdef USE_DEBOUNCE
+u32 debounceButtons(u32 raw) { // all 32 buttons at once, no branching per button
+  // each button has a DEBOUNCE_BITS wide counter spread over dbCnt[] (bit n of every word belongs to button n)
+  // the counter counts samples that differ from debounced state and is cleared by any sample that agrees with it,
+  // once it overflows the button toggles (counter is back at 0 by then)
+  u32 delta = raw ^ dbState;
+  u32 carry = delta;
+  for (u8 k = 0; k < DEBOUNCE_BITS; k++) { // ripple carry increment, unrolled by compiler
+    u32 c = dbCnt[k];
+    dbCnt[k] = (c ^ carry) & delta;
+    carry &= c;
+  }
+  dbState ^= carry;
+  return dbState;
+}
+#endif // end of debounce
+
+#ifdef USE_AUTOCALIB
+// frugal streaming quantile estimate of low and high limit of pedal i, O(1) memory and a few compares and adds per tick
+// a sample beyond a limit moves it out by AC_STEP, a sample inside moves it back in by AC_STEP >> AC_QBITS,
+// so a limit settles where 1 in 2^AC_QBITS+1 samples is beyond it and a run of n spikes moves it by at most n steps,
+// only samples on its own half of the range update a limit, so a pedal resting at one end does not pull the other limit in
+void autoCalib(u8 i, s32 v, int16_t *mn, int16_t *mx) {
+  s32 x = v << AC_FRAC;
+  s32 minSpan = (s32)(4 * dz) << AC_FRAC; // keeps map() range above the dead zones, no division by zero
+  if (!bitRead(acSeeded, i)) {
+    bitSet(acSeeded, i);
+    acLo[i] = x;
+    acHi[i] = x + minSpan;
+  }
+  b8 shrink = (acHi[i] - acLo[i]) > minSpan;
+  if (x < ((acLo[i] + acHi[i]) >> 1)) { // lower half, low limit
+    if (x < acLo[i]) {
+      acLo[i] -= AC_STEP;
+    } else if (shrink) {
+      acLo[i] += AC_STEP >> AC_QBITS;
+    }
+  } else { // upper half, high limit
+    if (x > acHi[i]) {
+      acHi[i] += AC_STEP;
+    } else if (shrink) {
+      acHi[i] -= AC_STEP >> AC_QBITS;
+    }
+  }
+  *mn = acLo[i] >> AC_FRAC;
+  *mx = acHi[i] >> AC_FRAC;
+}
+
+void acReset() { // forget learned pedal limits (serial command P), each pedal is reseeded from its next sample
+  acSeeded = 0;
+  memset(acLo, 0, sizeof(acLo));
+  memset(acHi, 0, sizeof(acHi));
+}
+#endif // end of autocalib
+
+#ifdef USE_PEDAL_CURVES
+void linearCurve(u8 p) { // straight line, output equals input
+  for (u8 k = 0; k < CURVE_POINTS; k++) pedalCurves[p][k] = k * (CURVE_ONE / (CURVE_POINTS - 1));
+}
+
+// pedal p response, v is axis value of bits resolution, top 4 bits select one of 16 curve segments and the rest interpolate within it
+s32 pedalCurve(u8 p, s32 v, u8 bits) {
+  u8 sh = bits - 4;
+  u8 seg = v >> sh;
+  s32 f = v & ((1L << sh) - 1);
+  s32 a = pedalCurves[p][seg];
+  s32 y = ((a << sh) + (pedalCurves[p][seg + 1] - a) * f) >> (CURVE_BITS - 4); // interpolated point, scaled from CURVE_ONE to axis range
+  if (y > (1L << bits) - 1) y = (1L << bits) - 1;
+  return y;
+}
+#endif // end of pedal curves
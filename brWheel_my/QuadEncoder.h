@@ -43,6 +43,9 @@ class cQuadEncoder {
   public:
     void Init (s32 position, b8 pullups = true); // milos, no additional pullup resistors needed if set true
     s32 Read ();
+#ifdef USE_COGGING
+    s32 ReadRaw ();
+#endif
     void Write (s32 pos);
     void Update ();
 
@@ -53,5 +56,7 @@ class cQuadEncoder {
 };
 
 extern cQuadEncoder gQuadEncoder;
+extern volatile u16 gEncInvalid; // edges where A/B did not change (glitch or missed pair of edges)
+extern volatile u16 gEncOverspeed; // edges where both A and B changed (one edge missed)
 
 #endif // _QUAD_ENCODER_H
@@ -36,8 +36,23 @@
 cQuadEncoder gQuadEncoder;
 
 volatile b8 gIndexFound;
+#if defined(GPIOR0) && !defined(ARDUINO_ARCH_RP2040)
+#define gLastState GPIOR0 // keep last A/B state in a general purpose I/O register (single cycle in/out from the ISR)
+#else
 volatile u8 gLastState;
+#endif
 volatile s32 gPosition;
+// generation byte, bumped by every writer of gPosition, lets the main loop read gPosition without masking interrupts
+#if defined(GPIOR1) && !defined(ARDUINO_ARCH_RP2040)
+#define gEncGen GPIOR1
+#else
+volatile u8 gEncGen;
+#endif
+#ifdef USE_COGGING
+volatile s32 gEncShift = 0; // sum of all moves done by Write(), gPosition + gEncShift stays tied to the motor shaft
+#endif
+volatile u16 gEncInvalid = 0; // counts "not possible" transitions (edge seen but A/B unchanged - glitch or a missed pair of edges)
+volatile u16 gEncOverspeed = 0; // counts double steps (both A and B changed - one edge was missed, direction is guessed)
 
 //--------------------------------------------------------------------------------------------------------
 
@@ -144,6 +159,7 @@ void cQuadEncoder::Init (s32 position, b8 pullups) {
 #endif // end of zindex
   gIndexFound = false;
   gPosition = position;
+  gEncGen = 0;
   gLastState = 0;
 #if defined(ARDUINO_ARCH_RP2040)
   if (digitalRead(QUAD_ENC_PIN_A)) gLastState |= 1;
@@ -164,20 +180,55 @@ void cQuadEncoder::Init (s32 position, b8 pullups) {
   //PCICR |= (1 << PCIE0);  //milos, commented out
 }
 
+// Lock-free read: gPosition is copied byte by byte, so if an encoder edge (or a recenter) lands in the middle of the copy
+// the generation byte has moved and we simply copy again. This saves no cycles, the read still costs about ~15 cycles
+// (estimate, not measured) as the old cli/sei version did. It only shortens interrupt latency: interrupts are never
+// masked, so encoder edges and USB interrupts are not held off by the read.
 s32 cQuadEncoder::Read() {
-  noInterrupts();
-  s32 pos = gPosition;
-  interrupts();
+  u8 gen;
+  s32 pos;
+  do {
+    gen = gEncGen;
+    pos = gPosition;
+  } while (gen != gEncGen);
+  return (pos);
+}
+
+#ifdef USE_COGGING
+s32 cQuadEncoder::ReadRaw() { // position that is not moved by recentering, counted from powerup (or from z-index pulse with USE_ZINDEX)
+  u8 gen;
+  s32 pos;
+  do {
+    gen = gEncGen;
+    pos = gPosition + gEncShift;
+  } while (gen != gEncGen);
   return (pos);
 }
+#endif
 
-void cQuadEncoder::Write (s32 pos) {
+void cQuadEncoder::Write (s32 pos) { // rare (center, calibration, CPR change), here we still have to block the encoder interrupts
+#if defined(ARDUINO_ARCH_RP2040)
   noInterrupts();
+#ifdef USE_COGGING
+  gEncShift += gPosition - pos;
+#endif
   gPosition = pos;
+  gEncGen++;
   interrupts();
+#else
+  u8 oldSREG = SREG; // can also be called from center button interrupt, so restore previous interrupt state instead of enabling
+  cli();
+#ifdef USE_COGGING
+  gEncShift += gPosition - pos;
+#endif
+  gPosition = pos;
+  gEncGen++;
+  SREG = oldSREG;
+#endif
 }
 
-s8 pos_inc[] =
+// increment table is kept in flash, index is (new B, new A, old B, old A)
+const s8 pos_inc[] PROGMEM =
 {
   0,		// 0 not possible
   1,		// 1
@@ -197,58 +248,78 @@ s8 pos_inc[] =
   0,		// 15 not possible
 };
 
-void cQuadEncoder::Update() {
+// Shared body of both encoder channel interrupts, forced inline so that the ISR only saves the few registers it really uses
+// (calling a non-inline function from an ISR makes avr-gcc push all call-clobbered registers on every edge).
+// On ATmega32U4 at 16MHz this is roughly 95 cycles per edge including entry/exit, which sets the ceiling at about
+// 170k edges/s summed over both channels, or 40k CPR at 4 rev/s of the encoder shaft (both figures are unmeasured
+// estimates counted from the instructions, not timed on hardware).
+static inline __attribute__((always_inline)) void quadEncoderStep() {
   u8 state = gLastState;
-  // 	if (digitalReadFast(QUAD_ENC_PIN_A)) state |= 4;
-  // 	if (digitalReadFast(QUAD_ENC_PIN_B)) state |= 8;
 #if defined(ARDUINO_ARCH_RP2040)
   if (digitalRead(QUAD_ENC_PIN_A)) state |= 4;
   if (digitalRead(QUAD_ENC_PIN_B)) state |= 8;
-  gLastState = (state >> 2);
-  gPosition += pos_inc[state];
-#ifdef USE_ZINDEX
-  if (!gIndexFound && digitalRead(QUAD_ENC_PIN_I)) {
-    gIndexFound = true;
-    zIndexFound = true;
-    brWheelFFB.state = 1;
-    gPosition = ROTATION_MID;
-  }
-#endif
 #else
-  u8 pd = PIND;	// Optim : change code according to the pins and the mcu used (or use the lines above)
-  state |= pd & 0b1100;
+  u8 pd = PIND;	// Optim : change code according to the pins and the mcu used
+  state |= pd & 0b1100; // A on PD2 (RX), B on PD3 (TX)
+#endif
   gLastState = (state >> 2);
-  gPosition += pos_inc[state];
+  s8 inc = pgm_read_byte(&pos_inc[state]);
+  if (inc == 0) { // edge interrupt without any change of A/B
+    gEncInvalid++;
+  } else {
+    if (!(inc & 1)) { // +-2, we have lost one edge
+      gEncOverspeed++;
+#if !defined(ARDUINO_ARCH_RP2040)
+      // both channels changed, so the other channel's edge is pending in EIFR and already handled here, clear it
+      // so that it is not counted again as invalid (an edge that comes in between PIND read and this write is dropped,
+      // but pins are read again on the next edge, so it just shows up as one more double step)
+      EIFR = (1 << INTF2) | (1 << INTF3);
+#endif
+    }
+    gPosition += inc;
+    gEncGen++;
+  }
+#ifdef USE_ZINDEX
   if (gIndexFound)
     return;
-  pd &= 2;
-  if (pd == 0)	//digitalReadFast(QUAD_ENC_PIN_I))
+#if defined(ARDUINO_ARCH_RP2040)
+  if (!digitalRead(QUAD_ENC_PIN_I))
+    return;
+#else
+  if (!(pd & 2)) // index on PD1 (D2)
     return;
-#ifdef USE_ZINDEX //milos, added
+#endif
   gIndexFound = true;
   zIndexFound = true;
   brWheelFFB.state = 1;
   gPosition = ROTATION_MID;
+#ifdef USE_COGGING
+  gEncShift = -ROTATION_MID; // raw position is 0 at index pulse, so cogging map stays aligned across powerups
 #endif
+  gEncGen++;
 #endif
 }
 
+void cQuadEncoder::Update() {
+  quadEncoderStep();
+}
+
 #if !defined(ARDUINO_ARCH_RP2040)
 ISR(INT2_vect) { // milos, interrupt activated function for RX
-  gQuadEncoder.Update(); // milos, otherwise we use it for optical encoder channel A on RX pin
+  quadEncoderStep(); // milos, otherwise we use it for optical encoder channel A on RX pin
 }
 
-ISR(INT3_vect) { // milos, interrupt activated function for TX
 #ifndef USE_QUADRATURE_ENCODER
+ISR(INT3_vect) { // milos, interrupt activated function for TX
 #ifdef USE_AS5600
 #ifdef USE_CENTERBTN
   recenter(); // milos, we re-map this interrupt for re-centering as5600 if optical encoder is unused
 #endif // end of centerbtn
 #endif // end of as5600
+}
 #else // if we use quad enc
-  gQuadEncoder.Update(); // milos, otherwise we use it for optical encoder channel B on TX pin
+ISR(INT3_vect, ISR_ALIASOF(INT2_vect)); // optical encoder channel B on TX pin jumps straight into the channel A handler
 #endif // end of quad enc
-}
 #else
 static void quad_isr_i() {
 #ifdef USE_ZINDEX
@@ -256,6 +327,10 @@ static void quad_isr_i() {
   zIndexFound = true;
   brWheelFFB.state = 1;
   gPosition = ROTATION_MID;
+#ifdef USE_COGGING
+  gEncShift = -ROTATION_MID; // raw position is 0 at index pulse, so cogging map stays aligned across powerups
+#endif
+  gEncGen++;
 #else
 #ifdef USE_CENTERBTN
   recenter();
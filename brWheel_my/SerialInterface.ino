@@ -128,6 +128,7 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
       case 'B': // milos, added to adjust brake load cell pressure
         ffb_temp = CONFIG_SERIAL.parseInt();
         LC_scaling = constrain(ffb_temp, 1, 255);
+        pwmBind(); // FFB balance shares this setting
         CONFIG_SERIAL.println(1);
         //SetParam(PARAM_ADDR_BRK_PRES, LC_scaling); // milos, update EEPROM
         break;
@@ -137,6 +138,7 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         brake.min = Z_AXIS_LOG_MAX, brake.max = 0;
         clutch.min = RX_AXIS_LOG_MAX, clutch.max = 0;
         hbrake.min = RY_AXIS_LOG_MAX, hbrake.max = 0;
+        acReset(); // otherwise next tick restores old limits from percentile estimates
         CONFIG_SERIAL.println(1);
 #else // if manual calib
         CONFIG_SERIAL.println(0);
@@ -144,10 +146,7 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         break;
       case 'O': // milos, added to adjust optical encoder CPR
 #ifdef USE_AS5600 // milos, with AS5600
-#ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-        temp1 = as5600x.getCumulativePosition() - ROTATION_MID; // milos
+        temp1 = as5600Pos(0) - ROTATION_MID; // milos
 #else // if no as5600
 #ifdef USE_QUADRATURE_ENCODER
         temp1 = myEnc.Read() - ROTATION_MID + brWheelFFB.offset; // milos
@@ -163,13 +162,9 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         ROTATION_MID = ROTATION_MAX >> 1; // milos, updated, divide by 2
         temp1 = int32_t(wheelAngle * float(ROTATION_MAX) / float(ROTATION_DEG)); // milos, here we recover the old wheel angle
 #ifdef USE_AS5600 // milos, with AS5600
+        as5600Reset(0, temp1 + ROTATION_MID); // milos
 #ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-        as5600x.resetCumulativePosition(temp1 + ROTATION_MID); // milos
-#ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 1); // milos, select 2nd i2C channel for AS5600(0x36) on y-axis
-        as5600y.resetCumulativePosition(temp1 + ROTATION_MID); // milos, 2nd as5600
+        as5600Reset(1, temp1 + ROTATION_MID); // milos, 2nd as5600
 #endif // end of tca
 #else // if no as5600
 #ifdef USE_QUADRATURE_ENCODER
@@ -186,13 +181,9 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         CONFIG_SERIAL.println(1);
 #else // if no zindex
 #ifdef USE_AS5600 // milos, with AS5600
+        as5600Reset(0, ROTATION_MID);
 #ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-        as5600x.resetCumulativePosition(ROTATION_MID);
-#ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 1); // milos, select 2nd i2C channel for AS5600(0x36) on y-axis
-        as5600y.resetCumulativePosition(ROTATION_MID);
+        as5600Reset(1, ROTATION_MID);
 #endif // end of tca
 #else // milos, if no as5600
 #ifdef USE_QUADRATURE_ENCODER
@@ -213,10 +204,7 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         break;
       case 'G': // milos, set new rotation angle
 #ifdef USE_AS5600 // milos, with AS5600
-#ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-        temp1 = as5600x.getCumulativePosition() - ROTATION_MID; // milos
+        temp1 = as5600Pos(0) - ROTATION_MID; // milos
 #else // if no as5600
 #ifdef USE_QUADRATURE_ENCODER
         temp1 = myEnc.Read() - ROTATION_MID + brWheelFFB.offset; // milos
@@ -232,13 +220,9 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         ROTATION_MID = ROTATION_MAX >> 1; // milos, updated, divide by 2
         temp1 = int32_t(wheelAngle * float(ROTATION_MAX) / float(ROTATION_DEG)); // milos, here we recover the old wheel angle
 #ifdef USE_AS5600 // milos, with AS5600
+        as5600Reset(0, temp1 + ROTATION_MID); // milos, 1st as5600
 #ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-        as5600x.resetCumulativePosition(temp1 + ROTATION_MID); // milos, 1st as5600
-#ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 1); // milos, select 2nd i2C channel for AS5600(0x36) on y-axis
-        as5600y.resetCumulativePosition(temp1 + ROTATION_MID); // milos, 2nd as5600
+        as5600Reset(1, temp1 + ROTATION_MID); // milos, 2nd as5600
 #endif // end of tca
 #else // if no as5600
 #ifdef USE_QUADRATURE_ENCODER
@@ -266,6 +250,7 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
           bitWrite(pwmstate, i, bitRead(ffb_temp, i));
         }
         SetParam(PARAM_ADDR_PWM_SET, pwmstate); // milos, update EEPROM with new pwm settings
+        pwmBind(); // new output mode applies right away, new frequency after restart
         temp = calcTOP(pwmstate) * minTorquePP; // milos, recalculate new min torque for curent min torque %
         SetParam(PARAM_ADDR_MIN_TORQ, temp); // milos, update min torque in EEPROM
         CONFIG_SERIAL.println(calcTOP(pwmstate));
@@ -411,6 +396,157 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
         CONFIG_SERIAL.println(0);
 #endif // end of autocalib
         break;
+      case 'T': // added - torque linearization curve
+#ifdef USE_TORQUE_LUT
+        c = toUpper(CONFIG_SERIAL.read());
+        if (c == 'S') { // set curve point
+          temp = CONFIG_SERIAL.parseInt();
+          temp1 = CONFIG_SERIAL.parseInt();
+          temp = constrain(temp, 0, TORQUE_LUT_POINTS - 1);
+          torqueLut[temp] = constrain(temp1, 0, TORQUE_LUT_ONE);
+          CONFIG_SERIAL.println(1);
+        } else if (c == 'L') { // reset to straight line from min torque
+          linearTorqueLut();
+          CONFIG_SERIAL.println(1);
+        } else if (c == 'R') { // curve readout
+          for (u8 k = 0; k < TORQUE_LUT_POINTS - 1; k++) {
+            CONFIG_SERIAL.print(torqueLut[k]);
+            CONFIG_SERIAL.print(" ");
+          }
+          CONFIG_SERIAL.println(torqueLut[TORQUE_LUT_POINTS - 1]);
+        }
+#else // if no torque lut
+        CONFIG_SERIAL.println(0);
+#endif // end of torque lut
+        break;
+      case 'Q': // added - cogging and friction compensation
+#ifdef USE_COGGING
+        c = toUpper(CONFIG_SERIAL.read());
+        if (c == 'L') { // start learning sweep
+          CONFIG_SERIAL.println(cogStart());
+        } else if (c == 'S') { // learning state
+          CONFIG_SERIAL.println(cogState);
+        } else if (c == 'C') { // clear map
+          cogClear();
+          CONFIG_SERIAL.println(1);
+        } else if (c == 'R') { // map readout, friction is last
+          for (u16 k = 0; k < COG_BINS; k++) {
+            CONFIG_SERIAL.print(cogMap[k]);
+            CONFIG_SERIAL.print(" ");
+          }
+          CONFIG_SERIAL.println(cogFric);
+        }
+#else // if no cogging
+        CONFIG_SERIAL.println(0);
+#endif // end of cogging
+        break;
+      case 'K': // added - pedal response curves
+#ifdef USE_PEDAL_CURVES
+        c = toUpper(CONFIG_SERIAL.read());
+        if (c >= 'A' && c <= 'D') { // set curve point, A-brake, B-accelerator, C-clutch, D-hand brake
+          temp = CONFIG_SERIAL.parseInt();
+          temp1 = CONFIG_SERIAL.parseInt();
+          temp = constrain(temp, 0, CURVE_POINTS - 1);
+          pedalCurves[c - 'A'][temp] = constrain(temp1, 0, CURVE_ONE);
+          CONFIG_SERIAL.println(1);
+        } else if (c == 'L') { // reset curve to linear
+          temp = CONFIG_SERIAL.parseInt();
+          linearCurve(constrain(temp, 0, 3));
+          CONFIG_SERIAL.println(1);
+        } else if (c == 'R') { // curve readout
+          temp = CONFIG_SERIAL.parseInt();
+          temp = constrain(temp, 0, 3);
+          for (u8 k = 0; k < CURVE_POINTS - 1; k++) {
+            CONFIG_SERIAL.print(pedalCurves[temp][k]);
+            CONFIG_SERIAL.print(" ");
+          }
+          CONFIG_SERIAL.println(pedalCurves[temp][CURVE_POINTS - 1]);
+        }
+#else // if no pedal curves
+        CONFIG_SERIAL.println(0);
+#endif // end of pedal curves
+        break;
+      case 'D': // added - diagnostics readout
+        c = toUpper(CONFIG_SERIAL.read());
+        switch (c) {
+          case 'E': // lost encoder counts since powerup
+#ifdef USE_QUADRATURE_ENCODER
+            noInterrupts(); // counters are updated from encoder interrupts
+            temp = gEncInvalid;
+            temp1 = gEncOverspeed;
+            interrupts();
+            CONFIG_SERIAL.print(temp);
+            CONFIG_SERIAL.print(" ");
+            CONFIG_SERIAL.println(temp1);
+#else // if no quad enc
+            CONFIG_SERIAL.println(0);
+#endif // end of quad enc
+            break;
+          case 'I': // failed background i2C transfers and control ticks without new AS5600 angle since powerup
+#ifdef USE_TWI_ASYNC
+            noInterrupts();
+            temp = twiErrors;
+            interrupts();
+            CONFIG_SERIAL.print(temp);
+            CONFIG_SERIAL.print(" ");
+#ifdef USE_AS5600
+            CONFIG_SERIAL.println(as5600Stale);
+#else // if no as5600
+            CONFIG_SERIAL.println(0);
+#endif // end of as5600
+#else // if no twi async
+            CONFIG_SERIAL.println("0 0");
+#endif // end of twi async
+            break;
+          case 'M': // button matrix scans with ghosting since powerup
+#ifdef USE_BTNMATRIX
+            CONFIG_SERIAL.println(mxGhosts);
+#else // if no button matrix
+            CONFIG_SERIAL.println(0);
+#endif // end of button matrix
+            break;
+          case 'S': // time per full shift register button read
+#ifdef USE_SHIFT_REGISTER
+            CONFIG_SERIAL.println(shrTime);
+#else // if no shift reg
+            CONFIG_SERIAL.println(0);
+#endif // end of shift reg
+            break;
+          case 'P': // stage timing statistics, one line per stage
+#ifdef USE_PROFILER
+            profDump();
+#else // if no profiler
+            CONFIG_SERIAL.println(0);
+#endif // end of profiler
+            break;
+          case 'C': // clear stage timing statistics
+#ifdef USE_PROFILER
+            profClear();
+            CONFIG_SERIAL.println(1);
+#else // if no profiler
+            CONFIG_SERIAL.println(0);
+#endif // end of profiler
+            break;
+          case 'T': // overruns, dropped releases and longest run time (us) of each task since powerup (ffb, report, serial)
+            for (u8 i = 0; i < TASK_NUM; i++) {
+              if (i > 0) CONFIG_SERIAL.print(" ");
+              CONFIG_SERIAL.print(tasks[i].overruns);
+              CONFIG_SERIAL.print(" ");
+              CONFIG_SERIAL.print(tasks[i].misses);
+              CONFIG_SERIAL.print(" ");
+              CONFIG_SERIAL.print(tasks[i].maxTime);
+            }
+            CONFIG_SERIAL.println();
+            break;
+          case 'B': // time (us) from powerup to end of setup, to first input report taken by host and until deferred boot was finished (0 while still booting)
+            CONFIG_SERIAL.print(bootSetup);
+            CONFIG_SERIAL.print(" ");
+            CONFIG_SERIAL.print(bootFirstReport);
+            CONFIG_SERIAL.print(" ");
+            CONFIG_SERIAL.println(bootDone);
+            break;
+        }
+        break;
       /*case 'Q': //milos, read and print out EEPROM contents
         uint8_t temp;
         for (uint8_t i = 0; i < 64; i++) {
@@ -498,6 +634,10 @@ void configCDC() { // milos, virtual serial port firmware configuration interfac
             ffb_temp = constrain(ffb_temp, 0, 255); //milos
             minTorquePP = (f32)ffb_temp * 0.001; // milos, max is 25.5% or 0.255
             MM_MIN_MOTOR_TORQUE = (u16)(minTorquePP * (f32)MM_MAX_MOTOR_TORQUE); // milos, we can set it during run time
+#ifdef USE_TORQUE_LUT
+            linearTorqueLut(); // min torque is the first point of torque curve, start over from a straight line
+#endif // end of torque lut
+            pwmBind(); // min torque is part of output maps
             CONFIG_SERIAL.println(1);
             break;
             /*case 'K': //milos, commented out, once set at compile time this must not be changed anymore
@@ -35,7 +35,9 @@
 #ifdef USE_VNH5019
 #include "DualVNH5019MotorShield.h"
 #endif
+#ifndef USE_TWI_ASYNC
 #include <Wire.h>
+#endif // end of twi async (has its own i2C driver)
 #ifdef USE_EEPROM
 #include <EEPROM.h> // milos, uncommented
 #endif
@@ -45,6 +47,9 @@
 #ifdef USE_LCD
 #include <LiquidCrystal_I2C.h> // milos, added
 #endif
+#ifdef USE_TWI_ASYNC
+#include "twi.h"
+#else // if no twi async, these libraries use Wire
 #ifdef USE_ADS1015
 #include <Adafruit_ADS1015.h> // milos, added
 #endif
@@ -54,8 +59,14 @@
 #ifdef USE_AS5600 // milos, added
 #include "AS5600.h"
 #endif
+#endif // end of twi async
+#include "prof.h"
 #if defined(ARDUINO_ARCH_RP2040)
 #include "tusb.h"
+#ifdef USE_ADC_SEQ
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#endif
 #endif
 
 //extern u8 valueglobal; // milos, commented out
@@ -73,6 +84,16 @@ s16 gasAxis; // milos, additional temp axis for accelerator (Z-axis) with no cal
 xysh shifter; // milos, added
 #endif // end of xy shifter
 s32a brake; // milos, we need 32bit due to 24 bits on load cell ADC, changed from s32
+#ifdef USE_TORQUE_LUT
+u16 torqueLut[TORQUE_LUT_POINTS]; // output torque for evenly spaced FFB torque, 0-TORQUE_LUT_ONE, first point is output for smallest non zero torque
+#endif // end of torque lut
+#ifdef USE_COGGING
+s8 cogMap[COG_BINS]; // torque correction for each bin of one motor revolution, in 1/COG_ONE of full torque
+u8 cogFric; // friction compensation, in 1/COG_ONE of full torque
+#endif // end of cogging
+#ifdef USE_PEDAL_CURVES
+u16 pedalCurves[4][CURVE_POINTS]; // response curve points, 0-CURVE_ONE (brake, accelerator, clutch, hand brake)
+#endif // end of pedal curves
 //s32 turn.x; // milos, x-axis (for optical or magnetic encoder)
 //s32 turn.y; // milos, y-axis (for 2nd magnetic encoder)
 s32v turn; // milos, struct containing scaled x and y-axis for usb send report (for one optical or two magnetic encoders)
@@ -81,6 +102,7 @@ s32v ffbs; // milos, instance of struct holding 2 axis FFB data
 u32 button = 0; // milos, added
 
 //milos, added
+#ifndef USE_TWI_ASYNC
 #ifdef USE_ADS1015
 //Adafruit_ADS1115 ads(0x48);     /* Use this for the 16-bit version */
 Adafruit_ADS1015 ads(0x48);    /* Use this for the 12-bit version */
@@ -90,6 +112,7 @@ Adafruit_ADS1015 ads(0x48);    /* Use this for the 12-bit version */
 Adafruit_MCP4725 dac0; // address 0x60, address pin connected to GND (or dissconected), left Force channel
 Adafruit_MCP4725 dac1; // address 0x61, address pin connected to VCC,                   right Force channel
 #endif
+#endif // end of twi async
 
 cFFB gFFB;
 BRFFB brWheelFFB;
@@ -97,13 +120,25 @@ BRFFB brWheelFFB;
 //milos, added
 #ifdef AVG_INPUTS
 extern s32 analog_inputs[];
+extern u8 axis_shift_n_bits[];
 u8 asc = 0; // milos, added - sample counter for averaging of analog inputs
 #endif
+#ifdef USE_ADS1015
+extern s16 adsVal[];
+#endif
+#ifdef USE_LOAD_CELL
+extern s32 lcVal;
+#endif
+#ifdef USE_SHIFT_REGISTER
+extern u16 shrTime;
+#endif
+extern u8 blinkCnt;
 
-u32 last_ConfigSerial = 0;
-u32 last_refresh = 0;
 u32 now_micros = micros();
-u32 timeDiffConfigSerial = now_micros;
+u8 bootStage = BOOT_LCD; // deferred boot stage, see taskBoot()
+u32 bootSetup = 0; // us from powerup until end of setup()
+u32 bootFirstReport = 0; // us from powerup to first USB input report
+u32 bootDone = 0; // us from powerup until deferred boot was finished
 
 uint16_t dz, bdz; // milos
 uint8_t last_LC_scaling; //milos
@@ -111,7 +146,7 @@ uint8_t last_LC_scaling; //milos
 
 #ifdef USE_LOAD_CELL // milos, added
 //HX711 constructor (dt pin, sck pin)
-HX711_ADC LoadCell(4, 5); // milos, added
+HX711_ADC LoadCell(LC_DOUT_PIN, LC_SCK_PIN); // milos, added
 #endif
 
 #ifdef USE_QUADRATURE_ENCODER
@@ -136,7 +171,7 @@ void stopIfFault() {
 }
 #endif
 
-#ifdef USE_AS5600 // milos, added i2C magnetic angular sensor
+#if defined(USE_AS5600) && !defined(USE_TWI_ASYNC) // milos, added i2C magnetic angular sensor
 AS5600L as5600x(0x36); // uses default wire.h, milos added, it has a fixed i2C address
 #ifdef USE_TWOFFBAXIS
 #ifdef USE_TCA9548
@@ -213,6 +248,15 @@ void setup() {
 #endif // end of mcp4725
   MM_MIN_MOTOR_TORQUE = 0;
   minTorquePP = 0.0;
+#ifdef USE_TORQUE_LUT
+  linearTorqueLut();
+#endif // end of torque lut
+#ifdef USE_COGGING
+  cogClear();
+#endif // end of cogging
+#ifdef USE_PEDAL_CURVES
+  for (u8 p = 0; p < 4; p++) linearCurve(p);
+#endif // end of pedal curves
 #ifdef USE_AUTOCALIB //milos, reset limits for autocalibration of pedals
   accel.min = Z_AXIS_LOG_MAX;
   accel.max = 0;
@@ -254,6 +298,9 @@ void setup() {
 #ifdef USE_CONFIGHID // milos, used only through HID configuration interface
   update(&fwOptions); // milos, added - update firmware options based on Config.h predefines
 #endif // end of config hid
+#ifdef USE_TWI_ASYNC
+  twiInit(); // 400kHz i2C driven by TWI interrupt, Wire library is not used
+#endif // end of twi async
   InitInputs();
   FfbSetDriver(0);
 
@@ -270,18 +317,10 @@ void setup() {
 
 #ifdef USE_QUADRATURE_ENCODER
 #ifndef USE_AS5600
-  (CALIBRATE_AT_INIT ? brWheelFFB.calibrate() : myEnc.Write(ROTATION_MID)); // milos, allways set encoder at 0deg (ROTATION_MID) at startup and calibrate if enabled
+  myEnc.Write(ROTATION_MID); // milos, allways set encoder at 0deg (ROTATION_MID) at startup, calibration (if enabled) is started by boot task
 #endif // end of as5600
 #endif // end of quad enc
 
-#ifdef USE_LCD // milos, not fully implemented yet
-  lcd.begin(16, 2);
-  lcd.clear();
-  lcd.setCursor(0, 0);
-  lcd.print("fw-v");
-  lcd.print(VERSION, DEC);
-#endif
-
 #ifdef USE_AUTOCALIB
 #ifdef AVG_INPUTS
   dz = 8; // milos, set the accel, brake and clutch pedal dead zones that will be taken from min and max axis val (default is 8 out of 4095)
@@ -295,6 +334,7 @@ void setup() {
   last_LC_scaling = LC_scaling; // milos, update last load cell scaling value (brake pressure)
 
 #ifdef USE_ADS1015 // milos, added
+#ifndef USE_TWI_ASYNC // with twi async gain is set by ADS_GAIN in Inputs.ino
   // When using ADS1015 board, all inputs are 12 bits resolution (4096 total steps, 0-4095 range)
   // The ADC input range (or gain) can be changed via the following
   // functions, but be careful never to exceed VDD +0.3V max, or to
@@ -310,9 +350,16 @@ void setup() {
   // ads.setGain(GAIN_SIXTEEN);    // 16x gain  +/- 0.256V  1 bit = 0.125mV  0.0078125mV
 
   ads.begin(); //milos, added
+#endif // end of twi async
+  InitAds(); // start first conversion
 #endif
 
 #ifdef USE_AS5600
+#ifdef USE_TWI_ASYNC
+  for (u8 i = 0; i < AS5600_NUM; i++) {
+    as5600Init(i); // filters off and initialize at 0deg at startup
+  }
+#else // if no twi async
 #ifndef USE_ADS1015
   Wire.begin(); // milos, D2-SDA and D3-SCL by default on Leonardo, Micro and proMicro boards
 #endif // end of ads1015
@@ -326,200 +373,191 @@ void setup() {
   as5600x.setSlowFilter(0); // milos, configure slow filter or readout precision: 0-best(slowest), 3-worst(fastest)
   //as5600x.setAddress(0x36); // milos, not needed here, i2C address already defined in function constructor
   //as5600x.setDirection(AS5600_CLOCK_WISE); // milos, not needed, but DIR pin should be on GND (not sure if it has a pulldown resistor)
-  as5600x.resetCumulativePosition(ROTATION_MID); // milos, initialize at 0deg at startup
+  as5600Reset(0, ROTATION_MID); // milos, initialize at 0deg at startup
 #ifdef USE_TWOFFBAXIS // milos, add a 2nd AS5600 sensor if we use 2 ffb axis and tca i2C multiplexer chip (we can use two i2C devices with the same i2C address)
 #ifdef USE_TCA9548 // milos, we just need to select i2C channel first on multiplexer and do the rest as usual
   TcaChannelSel(baseTCA0, 1); // milos, select 2nd i2C channel for AS5600(0x36) on y-axis and configure 2nd AS5600 the same way
   as5600y.begin();
   as5600y.setFastFilter(0);
   as5600y.setSlowFilter(0);
-  as5600y.resetCumulativePosition(ROTATION_MID);
+  as5600Reset(1, ROTATION_MID);
 #endif // end of tca
 #endif // end of 2 ffb axis
+#endif // end of twi async
 #endif // end of as5600
-  last_refresh = micros();
+#ifdef USE_PROFILER
+  profInit(); // start free running profiler timer
+#endif // end of profiler
+  bootSetup = micros();
+  taskInit(); // first FFB tick is due right away, slow inits (LCD, calibration, load cell tare) are left to boot task
 }
 
 //--------------------------------------------------------------------------------------------------------
-//------------------------------------ Main firmware loop ------------------------------------------------
+//------------------------------------ Task scheduler ----------------------------------------------------
 //--------------------------------------------------------------------------------------------------------
 
-void loop() {
-#if defined(ARDUINO_ARCH_RP2040)
-  tud_task();
-#endif
-#ifdef AVG_INPUTS //milos, added option see config.h
-  if (asc < avgSamples) {
-    ReadAnalogInputs(); // milos, get readings for averaging (only do it until we get all samples)
-    asc++; // milos
-  }
-#endif // end of avg inp
-
-  now_micros = micros(); // milos, we are polling the loop (FFB and USB reports are sent periodicaly)
-  {
-    timeDiffConfigSerial = now_micros - last_ConfigSerial; // milos, timer for serial interface
-
-    if ((now_micros - last_refresh) >= CONTROL_PERIOD) {
-#ifdef AVG_INPUTS //milos
-      asc = 0; // milos, reset counter for averaging
-#endif // end of avg_inputs
-      last_refresh = now_micros;  // milos, timer for FFB and USB reports
-      //SYNC_LED_HIGH(); // milos
-#ifdef  USE_SHIFT_REGISTER
-      for (uint8_t i = 0; i <= SHIFTS_NUM; i++) { // milos, read all states in one pass
-        nextInputState();  // milos, refresh state of shift register and read the next incoming bit
-      }
-#endif // end of shift register
+void taskFfb() { // encoder, FFB calculation and output
+  //SYNC_LED_HIGH(); // milos
+  PROF_BEGIN();
 #ifndef USE_AS5600 // milos, if AS5600 is not enabled quadrature encoder is used
 #ifdef USE_QUADRATURE_ENCODER
-      if (zIndexFound) {
-        turn.x = myEnc.Read() - ROTATION_MID + brWheelFFB.offset; // milos, only apply z-index offset if z-index pulse is found
-      } else {
-        turn.x = myEnc.Read() - ROTATION_MID;
-      }
+  if (zIndexFound) {
+    turn.x = myEnc.Read() - ROTATION_MID + brWheelFFB.offset; // milos, only apply z-index offset if z-index pulse is found
+  } else {
+    turn.x = myEnc.Read() - ROTATION_MID;
+  }
 #else // milos, if no optical enc and no as5600, use pot for X-axis
-      turn.x = map(accel.val, 0, Z_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, X-axis on accelerator
+  turn.x = map(accel.val, 0, Z_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, X-axis on accelerator
 #endif // end of quad enc
 #else // if we use as5600
 #ifdef USE_CENTERBTN
-      if (cButtonPressed) { // milos, reset magnetic encoders to 0 deg
-#ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-        turn.x = as5600x.resetCumulativePosition(ROTATION_MID);  // when using 1st magnetic encoder set X-axis to 0deg
+  if (cButtonPressed) { // milos, reset magnetic encoders to 0 deg
+    turn.x = as5600Reset(0, ROTATION_MID);  // when using 1st magnetic encoder set X-axis to 0deg
 #ifdef USE_TCA9548
-        TcaChannelSel(baseTCA0, 1); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-        turn.y = as5600y.resetCumulativePosition(ROTATION_MID);  // when using 2nd magnetic encoder set Y-axis to 0deg
+    turn.y = as5600Reset(1, ROTATION_MID);  // when using 2nd magnetic encoder set Y-axis to 0deg
 #endif // end of tca
-        cButtonPressed = false;
-      }
+    cButtonPressed = false;
+  }
 #endif // end of center btn
-#ifdef USE_TCA9548
-      TcaChannelSel(baseTCA0, 0); // milos, select 1st i2C channel for AS5600(0x36) on x-axis
-#endif // end of tca
-      turn.x = as5600x.getCumulativePosition() - ROTATION_MID; // milos, AS5600 angle readout
+  turn.x = as5600Pos(0) - ROTATION_MID; // milos, AS5600 angle readout (prefetched in background with twi async)
 #endif // end of as5600
-      axis.x = turn.x; // milos, xFFB on X-axis (optical or magnetic encoder)
+  axis.x = turn.x; // milos, xFFB on X-axis (optical or magnetic encoder)
 #ifdef USE_TWOFFBAXIS // milos, if 2 ffb axis, use Y-axis as input for yFFB axis
 #ifndef USE_TCA9548 // milos, if we don't use i2C multiplexer
-      axis.y = map(brake.val, 0, Y_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, temporary Y axis for yFFB force, scaled according to the encoder step size
+  axis.y = map(brake.val, 0, Y_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, temporary Y axis for yFFB force, scaled according to the encoder step size
 #else // if we use tca9548 read 2nd AS5600
-      TcaChannelSel(baseTCA0, 1); // milos, select 2nd i2C channel for AS5600(0x36) on y-axis
-      turn.y = as5600y.getCumulativePosition() - ROTATION_MID; // milos, 2nd AS5600 angle readout
-      axis.y = turn.y; // milos, yFFB on Y-axis (2nd magnetic encoder only)
+  turn.y = as5600Pos(1) - ROTATION_MID; // milos, 2nd AS5600 angle readout
+  axis.y = turn.y; // milos, yFFB on Y-axis (2nd magnetic encoder only)
 #endif // end of tca
 #endif // end of 2 ffb axis
 
 #ifdef USE_ANALOGFFBAXIS
-      if (indxFFBAxis(effstate) == 1) {
-        axis.x = map(brake.val, 0, Y_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, xFFB on Y-axis
-      } else if (indxFFBAxis(effstate) == 2) {
-        axis.x = map(accel.val, 0, Z_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, xFFB on Z-axis
-      } else if (indxFFBAxis(effstate) == 3) {
-        axis.x = map(clutch.val, 0, RX_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, xFFB on RX-axis
-      } else if (indxFFBAxis(effstate) == 4) {
-        axis.x = map(hbrake.val, 0, RY_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID);  // milos, xFFB on RY-axis
-      }
+  if (indxFFBAxis(effstate) == 1) {
+    axis.x = map(brake.val, 0, Y_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, xFFB on Y-axis
+  } else if (indxFFBAxis(effstate) == 2) {
+    axis.x = map(accel.val, 0, Z_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, xFFB on Z-axis
+  } else if (indxFFBAxis(effstate) == 3) {
+    axis.x = map(clutch.val, 0, RX_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID); // milos, xFFB on RX-axis
+  } else if (indxFFBAxis(effstate) == 4) {
+    axis.x = map(hbrake.val, 0, RY_AXIS_PHYS_MAX, -ROTATION_MID - 1, ROTATION_MID);  // milos, xFFB on RY-axis
+  }
 #endif // end of analog ffb axis
-      ffbs = gFFB.CalcTorqueCommands(&axis); // milos, passing pointer struct with x and y-axis, in encoder raw units -inf,0,inf
-      turn.x *= f32(X_AXIS_PHYS_MAX) / f32(ROTATION_MAX); // milos, conversion to physical HID units
-      turn.x = constrain(turn.x, -MID_REPORT_X - 1, MID_REPORT_X); // milos, -32768,0,32767 constrained to signed 16bit range
+  PROF_MARK(PROF_ENC);
+  ffbs = gFFB.CalcTorqueCommands(&axis); // milos, passing pointer struct with x and y-axis, in encoder raw units -inf,0,inf
+  PROF_MARK(PROF_FFB);
+  if (brWheelFFB.calibrating()) ffbs.x = brWheelFFB.calibrateTick(turn.x); // calibration turns the wheel instead of FFB
+  turn.x *= f32(X_AXIS_PHYS_MAX) / f32(ROTATION_MAX); // milos, conversion to physical HID units
+  turn.x = constrain(turn.x, -MID_REPORT_X - 1, MID_REPORT_X); // milos, -32768,0,32767 constrained to signed 16bit range
 #ifdef USE_TCA9548 // milos, do the same for y-axis
-      turn.y *= f32(Y_AXIS_PHYS_MAX) / f32(ROTATION_MAX);
-      turn.y = constrain(turn.y, -MID_REPORT_Y - 1, MID_REPORT_Y);
+  turn.y *= f32(Y_AXIS_PHYS_MAX) / f32(ROTATION_MAX);
+  turn.y = constrain(turn.y, -MID_REPORT_Y - 1, MID_REPORT_Y);
 #endif // end of tca
 
-      SetPWM(&ffbs); // milos, FFB signal is generated as digital PWM or analog DAC output (ffbs is a struct containing 2-axis FFB, here we pass it as pointer for calculating PWM or DAC signals)
-      //SYNC_LED_LOW(); //milos
-      // USB Report
-      {
-        //last_send = now_micros;
+  PROF_BEGIN();
+  SetPWM(&ffbs); // milos, FFB signal is generated as digital PWM or analog DAC output (ffbs is a struct containing 2-axis FFB, here we pass it as pointer for calculating PWM or DAC signals)
+  PROF_MARK(PROF_PWM);
+  //SYNC_LED_LOW(); //milos
+}
+
+void taskReport() { // pedals, buttons and USB input report
+  PROF_BEGIN();
+  //last_send = now_micros;
 #ifdef AVG_INPUTS //milos, added option see config.h
-        AverageAnalogInputs();				// Average readings
+  AverageAnalogInputs();				// Average readings
 #endif
 
 #ifdef USE_ADS1015 // milos, if you plan to use ADS1015 for all 3 pedals (no load cell) then use readADC_SingleEnded, for full 12bit use differential reading but only 2 such diff inputs are available
-        accel.val = constrain(ads.readADC_SingleEnded(ACCEL_INPUT), 0 , 2047); //milos, Z axis, 11bit
-        clutch.val = constrain(ads.readADC_SingleEnded(CLUTCH_INPUT), 0 , 2047); //milos, RX axis, 11bit
-        hbrake.val = constrain(ads.readADC_SingleEnded(HBRAKE_INPUT), 0 , 2047); //milos, RY axis, 11bit
-        //accel.val = constrain(ads.readADC_Differential_0_1()+2048, 0, 4095);  //milos, Z axis, 12bit
-        //clutch.val = constrain(ads.readADC_Differential_2_3()+2048, 0, 4095); //milos, RX axis, 12bit
+  accel.val = constrain(adsVal[ACCEL_INPUT], 0 , 2047); //milos, Z axis, 11bit (converted in background by adsService)
+  clutch.val = constrain(adsVal[CLUTCH_INPUT], 0 , 2047); //milos, RX axis, 11bit
+  hbrake.val = constrain(adsVal[HBRAKE_INPUT], 0 , 2047); //milos, RY axis, 11bit
+  //accel.val = constrain(ads.readADC_Differential_0_1()+2048, 0, 4095);  //milos, Z axis, 12bit
+  //clutch.val = constrain(ads.readADC_Differential_2_3()+2048, 0, 4095); //milos, RX axis, 12bit
 
 #else //if no ads1015
 #ifdef AVG_INPUTS // milos, we do not average h-shifter axis, only pedal axis
-        accel.val = analog_inputs[ACCEL_INPUT];
+  accel.val = analog_inputs[ACCEL_INPUT];
 #ifdef USE_PROMICRO
 #ifndef USE_XY_SHIFTER
-        clutch.val = analog_inputs[CLUTCH_INPUT];
-        hbrake.val = analog_inputs[HBRAKE_INPUT];
+  clutch.val = analog_inputs[CLUTCH_INPUT];
+  hbrake.val = analog_inputs[HBRAKE_INPUT];
 #else // milos, if we use h-shifter on proMicro with avg inputs
-        clutch.val = 0;
-        hbrake.val = 0;
-        shifter.x = analogRead(CLUTCH_PIN); // milos
-        shifter.y = analogRead(HBRAKE_PIN); // milos
+  clutch.val = 0;
+  hbrake.val = 0;
+#ifdef USE_ADC_SEQ // analogRead would disturb background sampling, take shifter from averaged clutch and hbrake inputs
+  shifter.x = analog_inputs[CLUTCH_INPUT] >> (axis_shift_n_bits[CLUTCH_INPUT] + ADC_OSR_BITS);
+  shifter.y = analog_inputs[HBRAKE_INPUT] >> (axis_shift_n_bits[HBRAKE_INPUT] + ADC_OSR_BITS);
+#else // if no adc seq
+  shifter.x = analogRead(CLUTCH_PIN); // milos
+  shifter.y = analogRead(HBRAKE_PIN); // milos
+#endif // end of adc seq
 #endif // end of xy shifter
 #else // for leonardo we can avg pedal inputs and also have h-shifter axis
-        clutch.val = analog_inputs[CLUTCH_INPUT];
-        hbrake.val = analog_inputs[HBRAKE_INPUT];
+  clutch.val = analog_inputs[CLUTCH_INPUT];
+  hbrake.val = analog_inputs[HBRAKE_INPUT];
 #ifdef USE_XY_SHIFTER
-        shifter.x = analogRead(SHIFTER_X_PIN); // milos
-        shifter.y = analogRead(SHIFTER_Y_PIN); // milos
+#ifdef USE_ADC_SEQ
+  shifter.x = adcSeqShifter(0); // shifter axis are sampled in the background after pedals
+  shifter.y = adcSeqShifter(1);
+#else // if no adc seq
+  shifter.x = analogRead(SHIFTER_X_PIN); // milos
+  shifter.y = analogRead(SHIFTER_Y_PIN); // milos
+#endif // end of adc seq
 #endif // end of h-shifter
 #endif // end of proMicro
 #else // if no avg
 #ifndef USE_SPLITAXIS
-        accel.val = analogRead(ACCEL_PIN); // milos, Z axis
+  accel.val = analogRead(ACCEL_PIN); // milos, Z axis
 #else // milos, use combined axis for gas and brake
 #ifdef USE_QUADRATURE_ENCODER // milos, when using optical encoder
-        combinedAxis = analogRead(ACCEL_PIN); // milos, store accelerator into temporary axis
-        if (combinedAxis >= 512) {
-          accel.val = map(combinedAxis, 512, 1023, 0, 1023); // milos, this is now Z-axis (accelerator)
-          brake.val = 0;
-        } else {
-          accel.val = 0;
-          brake.val = map(combinedAxis, 511, 0, 0, 1023);  // milos, this is now Y-axis (brake)
-        }
+  combinedAxis = analogRead(ACCEL_PIN); // milos, store accelerator into temporary axis
+  if (combinedAxis >= 512) {
+    accel.val = map(combinedAxis, 512, 1023, 0, 1023); // milos, this is now Z-axis (accelerator)
+    brake.val = 0;
+  } else {
+    accel.val = 0;
+    brake.val = map(combinedAxis, 511, 0, 0, 1023);  // milos, this is now Y-axis (brake)
+  }
 #else // milos, without optical encoder
-        accel.val = analogRead(ACCEL_PIN); // milos, accelerator is used for X axis
-        combinedAxis = analogRead(BRAKE_PIN); // milos, store brake into temporary axis
-        if (combinedAxis >= 512) {
-          gasAxis = map(combinedAxis, 512, 1023, 0, Z_AXIS_PHYS_MAX); // milos, this is now Z-axis (accelerator)
-          brake.val = 0;
-        } else {
-          gasAxis = 0;
-          brake.val = map(combinedAxis, 511, 0, 0, 1023);  // milos, this is now Y-axis (brake)
-        }
+  accel.val = analogRead(ACCEL_PIN); // milos, accelerator is used for X axis
+  combinedAxis = analogRead(BRAKE_PIN); // milos, store brake into temporary axis
+  if (combinedAxis >= 512) {
+    gasAxis = map(combinedAxis, 512, 1023, 0, Z_AXIS_PHYS_MAX); // milos, this is now Z-axis (accelerator)
+    brake.val = 0;
+  } else {
+    gasAxis = 0;
+    brake.val = map(combinedAxis, 511, 0, 0, 1023);  // milos, this is now Y-axis (brake)
+  }
 #endif // end of quad encoder        
 #endif // end of splitaxis
 #ifndef USE_PROMICRO // milos, for Leonardo and Micro
 #ifndef USE_EXTRABTN // milos, we can have clutch and hbrake only when not using extra buttons
-        clutch.val = analogRead(CLUTCH_PIN); // milos, RX axis
-        hbrake.val = analogRead(HBRAKE_PIN); // milos, RY axis
+  clutch.val = analogRead(CLUTCH_PIN); // milos, RX axis
+  hbrake.val = analogRead(HBRAKE_PIN); // milos, RY axis
 #else // if extra buttons
-        clutch.val = 0; // milos, RX axis
-        hbrake.val = 0; // milos, RY axis
+  clutch.val = 0; // milos, RX axis
+  hbrake.val = 0; // milos, RY axis
 #endif // end of extra button
 #ifdef USE_XY_SHIFTER // milos
-        shifter.x = analogRead(SHIFTER_X_PIN); // milos
-        shifter.y = analogRead(SHIFTER_Y_PIN); // milos
+  shifter.x = analogRead(SHIFTER_X_PIN); // milos
+  shifter.y = analogRead(SHIFTER_Y_PIN); // milos
 #endif // end of xy shifter
 #else // if we use proMicro
 #ifdef USE_XY_SHIFTER // milos, compromize - for proMicro with XY shifter, we can't have clutch and handbrake
-        clutch.val = 0; // milos, RX axis
-        hbrake.val = 0; // milos, RY axis
-        shifter.x = analogRead(CLUTCH_PIN); // milos, use clutch analog input instead
-        shifter.y = analogRead(HBRAKE_PIN); // milos, use handbrake analog input instead
+  clutch.val = 0; // milos, RX axis
+  hbrake.val = 0; // milos, RY axis
+  shifter.x = analogRead(CLUTCH_PIN); // milos, use clutch analog input instead
+  shifter.y = analogRead(HBRAKE_PIN); // milos, use handbrake analog input instead
 #else // for proMicro, when no XY shifter
 #ifndef USE_EXTRABTN // milos, only available if not using extra buttons
-        clutch.val = analogRead(CLUTCH_PIN); // milos, RX axis
-        hbrake.val = analogRead(HBRAKE_PIN); // milos, RY axis
+  clutch.val = analogRead(CLUTCH_PIN); // milos, RX axis
+  hbrake.val = analogRead(HBRAKE_PIN); // milos, RY axis
 #else // if using extra buttons
 #ifndef USE_LOAD_CELL
-        clutch.val = 0; // milos, RX axis unavailable when no lc
+  clutch.val = 0; // milos, RX axis unavailable when no lc
 #else // if no load cell
-        clutch.val = analogRead(CLUTCH_PIN); // milos, RX axis is available if we use lc
+  clutch.val = analogRead(CLUTCH_PIN); // milos, RX axis is available if we use lc
 #endif // end of use lc
-        hbrake.val = 0; // milos, RY axis is allways unavailable
+  hbrake.val = 0; // milos, RY axis is allways unavailable
 #endif // end of extra button
 #endif // end of xy shifter
 #endif // end proMicro
@@ -527,24 +565,22 @@ void loop() {
 #endif // end of ads
 
 #ifdef USE_LOAD_CELL // milos, when use LC
-        if (LC_scaling != last_LC_scaling) { // milos, apply only if changed (through serial interface)
-          LoadCell.setCalFactor(0.25 * float(LC_scaling)); // user set calibration factor (float)
-          last_LC_scaling = LC_scaling; // milos, update new value
-          LoadCell.tare(); // milos, zero out the measurement using new scaling factor
-        }
-        // milos, update() should be called at least as often as HX711 sample rate; >10Hz@10SPS, >80Hz@80SPS
-        // milos, we are calling it in every polling interval
-        LoadCell.update(); // milos, I have configured mine for 80Hz reading by applying 5V at pin15 of HX711 chip (by default it's only 10Hz because pin15 is grounded in PCB, you must cut this trace)
-        brake.val = LoadCell.getData(); // milos, read smoothed data from LC (running average of 1 sample, see provided HX711_ADC.h and adjust there if more samples are needed)
+  if (LC_scaling != last_LC_scaling) { // milos, apply only if changed (through serial interface)
+    lcSetScaling(LC_scaling); // user set calibration factor, integer multiplier
+    last_LC_scaling = LC_scaling; // milos, update new value
+    lcTareStart(); // milos, zero out the measurement using new scaling factor (takes next LC_TARE_SAMPLES samples)
+  }
+  // milos, I have configured mine for 80Hz reading by applying 5V at pin15 of HX711 chip (by default it's only 10Hz because pin15 is grounded in PCB, you must cut this trace)
+  brake.val = lcVal; // latest median filtered and scaled sample, lcService() reads HX711 from main loop as soon as it is ready
 #else // milos, when no LC
 #ifdef USE_ADS1015
-        brake.val = constrain(ads.readADC_SingleEnded(BRAKE_INPUT), 0 , 2047); // milos, Y axis, 11bit
+  brake.val = constrain(adsVal[BRAKE_INPUT], 0 , 2047); // milos, Y axis, 11bit
 #else // if no ads
 #ifdef AVG_INPUTS // milos, added option
-        brake.val = analog_inputs[BRAKE_INPUT];
+  brake.val = analog_inputs[BRAKE_INPUT];
 #else // if no avg
 #ifndef USE_SPLITAXIS // milos, calculated above
-        brake.val = analogRead(BRAKE_PIN); // milos, Y axis
+  brake.val = analogRead(BRAKE_PIN); // milos, Y axis
 #else
 #endif
 #endif // end of avg
@@ -552,85 +588,225 @@ void loop() {
 #endif // end of lc
 
 #ifdef  USE_AUTOCALIB // milos, update limits for pedal autocalibration
-        if (accel.val < accel.min) accel.min = accel.val;
-        if (accel.val > accel.max) accel.max = accel.val;
-        if (brake.val < brake.min) brake.min = brake.val;
-        if (brake.val > brake.max) brake.max = brake.val;
-        if (clutch.val < clutch.min) clutch.min = clutch.val;
-        if (clutch.val > clutch.max) clutch.max = clutch.val;
-        if (hbrake.val < hbrake.min) hbrake.min = hbrake.val;
-        if (hbrake.val > hbrake.max) hbrake.max = hbrake.val;
+  autoCalib(0, accel.val, &accel.min, &accel.max);
+#ifndef USE_LOAD_CELL // load cell brake has its own scaling
+  autoCalib(1, brake.val, &brake.min, &brake.max);
+#endif // end of load cell
+  autoCalib(2, clutch.val, &clutch.min, &clutch.max);
+  autoCalib(3, hbrake.val, &hbrake.min, &hbrake.max);
 #endif // end of autocalib
 #ifdef USE_AVGINPUTS
-        // milos, update calibration limits for increased axis resolution due to averaging (depends on num of samples)
-        accel.min *= avgSamples;
-        accel.max *= avgSamples;
+  // milos, update calibration limits for increased axis resolution due to averaging (depends on num of samples)
+  accel.min *= avgSamples;
+  accel.max *= avgSamples;
 #ifndef USE_LOADCELL
-        brake.min *= avgSamples;
-        brake.max *= avgSamples;
+  brake.min *= avgSamples;
+  brake.max *= avgSamples;
 #endif // end of load cell
-        clutch.min *= avgSamples;
-        clutch.max *= avgSamples;
-        hbrake.min *= avgSamples;
-        hbrake.max *= avgSamples;
+  clutch.min *= avgSamples;
+  clutch.max *= avgSamples;
+  hbrake.min *= avgSamples;
+  hbrake.max *= avgSamples;
 #endif // end of avg inputs
 
-        // milos, rescale all analog axis according to a new manual calibration and add small deadzones
-        accel.val = map(accel.val, accel.min + dz, accel.max - dz, 0, Z_AXIS_PHYS_MAX);  // milos, with manual calibration and dead zone
-        clutch.val = map(clutch.val, clutch.min + dz, clutch.max - dz, 0, RX_AXIS_PHYS_MAX);
-        hbrake.val = map(hbrake.val, hbrake.min + dz, hbrake.max - dz, 0, RY_AXIS_PHYS_MAX);
-        accel.val = constrain(accel.val, 0, Z_AXIS_PHYS_MAX); // milos, constrain axis ranges
-        clutch.val = constrain(clutch.val, 0, RX_AXIS_PHYS_MAX);
-        hbrake.val = constrain(hbrake.val, 0, RY_AXIS_PHYS_MAX);
+  // milos, rescale all analog axis according to a new manual calibration and add small deadzones
+  accel.val = map(accel.val, accel.min + dz, accel.max - dz, 0, Z_AXIS_PHYS_MAX);  // milos, with manual calibration and dead zone
+  clutch.val = map(clutch.val, clutch.min + dz, clutch.max - dz, 0, RX_AXIS_PHYS_MAX);
+  hbrake.val = map(hbrake.val, hbrake.min + dz, hbrake.max - dz, 0, RY_AXIS_PHYS_MAX);
+  accel.val = constrain(accel.val, 0, Z_AXIS_PHYS_MAX); // milos, constrain axis ranges
+  clutch.val = constrain(clutch.val, 0, RX_AXIS_PHYS_MAX);
+  hbrake.val = constrain(hbrake.val, 0, RY_AXIS_PHYS_MAX);
 
 #ifdef USE_LOAD_CELL // milos, with load cell
-        if (brake.val < bdz) { // milos, if values below deadzone threshold
-          brake.val = 0; // milos, truncate
-        } else {
-          brake.val = map(brake.val, bdz, Y_AXIS_PHYS_MAX + bdz, 0, Y_AXIS_PHYS_MAX); // milos, no autocalibration
-        }
+  if (brake.val < bdz) { // milos, if values below deadzone threshold
+    brake.val = 0; // milos, truncate
+  } else {
+    brake.val = map(brake.val, bdz, Y_AXIS_PHYS_MAX + bdz, 0, Y_AXIS_PHYS_MAX); // milos, no autocalibration
+  }
 #else // milos, when no load cell
-        brake.val = map(brake.val, brake.min + dz, brake.max - dz, 0, Y_AXIS_PHYS_MAX); // milos, for both manual and auto cal
+  brake.val = map(brake.val, brake.min + dz, brake.max - dz, 0, Y_AXIS_PHYS_MAX); // milos, for both manual and auto cal
 #endif // end of load cell
-        brake.val = constrain(brake.val, 0, Y_AXIS_PHYS_MAX); // milos
-
-        button = readInputButtons(); // milos, read all buttons including matrix and hat switch
+  brake.val = constrain(brake.val, 0, Y_AXIS_PHYS_MAX); // milos
+#ifdef USE_PEDAL_CURVES
+  brake.val = pedalCurve(0, brake.val, Y_AXIS_NB_BITS);
+  accel.val = pedalCurve(1, accel.val, Z_AXIS_NB_BITS);
+  clutch.val = pedalCurve(2, clutch.val, RX_AXIS_NB_BITS);
+  hbrake.val = pedalCurve(3, hbrake.val, RY_AXIS_NB_BITS);
+#endif // end of pedal curves
+
+  PROF_MARK(PROF_PEDALS);
+#ifdef  USE_SHIFT_REGISTER
+  u32 shrStart = micros();
+  readShiftRegister();
+  shrTime = micros() - shrStart; // time per full button read, readout with serial command DS
+#endif // end of shift register
+  button = readInputButtons(); // milos, read all buttons including matrix and hat switch
 
 #ifdef USE_XY_SHIFTER // milos, added
-        if ((bitRead(shifter.cfg, 2))) shifter.x = 1023 - shifter.x; // milos, invert shifter X-axis
-        if ((bitRead(shifter.cfg, 3))) shifter.y = 1023 - shifter.y; // milos, invert shifter Y-axis
-        button = decodeXYshifter(button, &shifter); // milos, added - convert analog XY shifter values into last 8 buttons
+  if ((bitRead(shifter.cfg, 2))) shifter.x = 1023 - shifter.x; // milos, invert shifter X-axis
+  if ((bitRead(shifter.cfg, 3))) shifter.y = 1023 - shifter.y; // milos, invert shifter Y-axis
+  button = decodeXYshifter(button, &shifter); // milos, added - convert analog XY shifter values into last 8 buttons
 #endif //end of xy shifter
+  PROF_MARK(PROF_BUTTONS);
 
 #ifdef USE_QUADRATURE_ENCODER // milos, if we use quad enc
-        SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, accel.val, clutch.val, hbrake.val, button); // milos, X, Y, Z, RX, RY, hat+button; (0-65535) X-axis range, center at 32768
+  SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, accel.val, clutch.val, hbrake.val, button); // milos, X, Y, Z, RX, RY, hat+button; (0-65535) X-axis range, center at 32768
 #else // milos, if no quad enc
 #ifdef USE_AS5600 // milos, if we use one as5600
 #ifndef USE_TCA9548 // milos, if we don't use two as5600
-        SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, accel.val, clutch.val, hbrake.val, button); // milos, one as5600 at x-axis
+  SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, accel.val, clutch.val, hbrake.val, button); // milos, one as5600 at x-axis
 #else // with tca, if two as5600
-        SendInputReport(turn.x + MID_REPORT_Y + 1, turn.y + MID_REPORT_Y + 1, accel.val, clutch.val, hbrake.val, button); // milos, we use two as5600, send 2nd as5600 at y-axis instead of brake pedal
+  SendInputReport(turn.x + MID_REPORT_Y + 1, turn.y + MID_REPORT_Y + 1, accel.val, clutch.val, hbrake.val, button); // milos, we use two as5600, send 2nd as5600 at y-axis instead of brake pedal
 #endif // end of tca
 #else // milos, if no quad enc and no as5600, Z-axis (accel) is used for X-axis, but we have have to send something instead of Z-axis -> half axis value for example
 #ifndef USE_SPLITAXIS // milos, only if not using combined gas and brake axis
-        SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, Z_AXIS_PHYS_MAX >> 1, clutch.val, hbrake.val, button); // milos
+  SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, Z_AXIS_PHYS_MAX >> 1, clutch.val, hbrake.val, button); // milos
 #else // milos, when usign split axis, we have one more uncalibrated axis available to use for Z-axis
-        SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, gasAxis, clutch.val, hbrake.val, button); // milos, full analog joystick
+  SendInputReport(turn.x + MID_REPORT_X + 1, brake.val, gasAxis, clutch.val, hbrake.val, button); // milos, full analog joystick
 #endif // end of split axis
 #endif // end of as5600
 #endif // end of quad enc
+  PROF_MARK(PROF_REPORT);
+  if (bootFirstReport == 0 && hidReportSent) bootFirstReport = micros(); // only once host has configured us and taken the report
 
-#ifdef AVG_INPUTS //milos, added option see config.h
-        ClearAnalogInputs();
+#if defined(AVG_INPUTS) && !defined(USE_ADC_SEQ) //milos, added option see config.h (adc seq integrators are never cleared)
+  ClearAnalogInputs();
+  asc = 0; // milos, reset counter for averaging
 #endif // end of avg inp
+}
+
 #ifdef USE_CONFIGCDC
-        if (timeDiffConfigSerial >= CONFIG_SERIAL_PERIOD) {
-          configCDC(); // milos, configure firmware with virtual serial port
-          last_ConfigSerial = now_micros;
-        }
+void taskConfig() { // serial interface commands
+  PROF_BEGIN();
+  configCDC(); // milos, configure firmware with virtual serial port
+  PROF_MARK(PROF_CONFIG);
+}
 #endif // end of use config cdc
-      }
-      //SYNC_LED_LOW(); //milos
-    }
+
+void taskBoot() { // deferred boot, one stage per run so that FFB ticks and input reports keep going
+  blinkFFBclipLED();
+  switch (bootStage) {
+    case BOOT_LCD:
+#ifdef USE_LCD // milos, not fully implemented yet
+      lcd.begin(16, 2); // blocks for a few tens of ms, but only once
+      lcd.clear();
+      lcd.setCursor(0, 0);
+      lcd.print("fw-v");
+      lcd.print(VERSION, DEC);
+#endif // end of lcd
+      bootStage = BOOT_CAL;
+      break;
+    case BOOT_CAL:
+#ifdef USE_QUADRATURE_ENCODER
+#ifndef USE_AS5600
+      if (CALIBRATE_AT_INIT) brWheelFFB.calibrate(); // runs in FFB task from next tick
+#endif // end of as5600
+#endif // end of quad enc
+      bootStage = BOOT_LOAD_CELL;
+      break;
+    case BOOT_LOAD_CELL:
+      if (blinkCnt > 0) break; // let startup blink finish first, LED is left off and FFB clip indication takes over
+#ifdef USE_LOAD_CELL
+      if (millis() < LC_SETTLE_MS) break; // HX711 is still warming up
+      lcStart(); // tare takes next LC_TARE_SAMPLES samples in lcService()
+#endif // end of load cell
+      bootStage = BOOT_DONE;
+      bootDone = micros();
+      taskStop(taskBoot); // nothing left to do, do not release it anymore
+      break;
+  }
+}
+
+// static task table in priority order, FFB task must be first and report task follows it in the same control period
+// a released task is started if it is the highest priority one ready and its budget fits before the next FFB tick
+// (or if it has already waited a full period), overruns and dropped releases are counted (readout with serial command DT)
+task tasks[] = {
+  {taskFfb, CONTROL_PERIOD, 0, TASK_FFB_BUDGET},
+  {taskReport, CONTROL_PERIOD, 0, TASK_REPORT_BUDGET},
+#ifdef USE_CONFIGCDC
+  {taskConfig, CONFIG_SERIAL_PERIOD, CONTROL_PERIOD / 2, TASK_CONFIG_BUDGET}, // half a period after FFB tick
+#endif // end of use config cdc
+  {taskBoot, BOOT_PERIOD, BOOT_PERIOD, TASK_BOOT_BUDGET}, // first step one period after first report
+};
+#define TASK_NUM (sizeof(tasks) / sizeof(tasks[0]))
+#if defined(USE_TWI_ASYNC) && defined(USE_AS5600)
+#define TASK_GUARD_US TWI_PREFETCH_US // lower priority tasks must be done before AS5600 reads for the next tick are queued
+#else
+#define TASK_GUARD_US 0
+#endif
+
+void taskInit() {
+  u32 t = micros();
+  for (u8 i = 0; i < TASK_NUM; i++) {
+    tasks[i].release = t + tasks[i].phase;
+  }
+}
+
+static void taskRun(task *t) {
+  u32 start = micros();
+  t->run();
+  u32 dt = micros() - start;
+  if (dt > t->budget) t->overruns++;
+  if (dt > t->maxTime) t->maxTime = (dt > 0xFFFF) ? 0xFFFF : dt;
+  t->release += t->period; // next release stays on the period grid
+  while ((s32)(start - t->release) >= 0) { // started a full period late, drop missed releases instead of running them back to back
+    t->release += t->period;
+    t->misses++;
   }
 }
+
+void taskStop(void (*run)()) { // period 0 marks a task that is never released again
+  for (u8 i = 0; i < TASK_NUM; i++) {
+    if (tasks[i].run == run) tasks[i].period = 0;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------------
+//------------------------------------ Main firmware loop ------------------------------------------------
+//--------------------------------------------------------------------------------------------------------
+
+void loop() {
+#if defined(ARDUINO_ARCH_RP2040)
+  tud_task();
+#endif
+#if defined(AVG_INPUTS) && !defined(USE_ADC_SEQ) //milos, added option see config.h (ADC interrupt does sampling with adc seq)
+  if (asc < avgSamples) {
+    ReadAnalogInputs(); // milos, get readings for averaging (only do it until we get all samples)
+    asc++; // milos
+  }
+#endif // end of avg inp
+
+  now_micros = micros(); // milos, we are polling the loop (FFB and USB reports are sent periodicaly)
+  u8 i;
+  for (i = 0; i < TASK_NUM; i++) {
+    task *t = &tasks[i];
+    if (t->period == 0) continue; // stopped
+    s32 late = now_micros - t->release;
+    if (late < 0) continue; // not released yet
+    if (i > 0 && (s32)(tasks[0].release - now_micros) < (s32)(t->budget + TASK_GUARD_US) && late < (s32)t->period) continue; // would delay next FFB tick (or AS5600 reads queued before it), wait for a bigger gap (at most one period)
+    taskRun(t);
+    break; // one task per pass, background services below run in between and a released FFB tick never waits behind lower priority tasks
+  }
+#ifdef USE_PROFILER
+  if (i == TASK_NUM) profCollect(); // no task was due, update stage statistics in spare time
+#endif // end of profiler
+#ifdef USE_ADS1015
+  adsService(); // read out finished pedal conversion and start the next one
+#endif // end of ads1015
+#if defined(USE_TWI_ASYNC) && defined(USE_MCP4725)
+  dacService(); // send DAC codes that had to wait for i2C bus
+#endif
+#ifdef USE_LOAD_CELL
+  lcService(); // take HX711 sample right when it is ready
+#endif // end of load cell
+#ifdef USE_BTNMATRIX
+  matrixService(); // read one button matrix row and select the next one
+#endif // end of button matrix
+#ifdef USE_TWI_ASYNC
+#ifdef USE_AS5600
+  if ((s32)(now_micros - tasks[0].release) >= -TWI_PREFETCH_US) {
+    as5600Prefetch(); // start reading magnetic encoders, so that angles are ready at the next tick
+  }
+#endif // end of as5600
+#endif // end of twi async
+}
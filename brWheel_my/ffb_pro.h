@@ -92,13 +92,28 @@ class cFFB {
     b8 mAutoCenter;
 };
 
+#define CAL_IDLE         0 // calibration steps
+#define CAL_START        1
+#define CAL_TURN         2
+#define CAL_STOP_TICKS   (300000L / CONTROL_PERIOD) // check for endstop every 300ms
+#define CAL_ZINDEX_TICKS (50000L / CONTROL_PERIOD) // check for full turn without z-index every 50ms
+
 class BRFFB {
   public:
     BRFFB();
     void calibrate();
+    b8 calibrating();
+    s32 calibrateTick(s32 pos);
     s32 offset;
-    b8 state;
+    b8 state; // 0 - not calibrated, 1 - calibrated or z-index found, 2 - calibration error, 3 - no z-index found, 4 - calibrating
     //b8 autoCenter;
+  private:
+    void calibrateDone(u8 result);
+    u8 calStep;
+    u8 calCount; // number of checks so far
+    u16 calTicks; // control ticks since last check
+    s32 calStart; // position where calibration started
+    s32 calLast; // position at last check
 };
 
 #endif // _FFB_PRO_
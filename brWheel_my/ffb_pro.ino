@@ -554,94 +554,78 @@ s32v cFFB::CalcTorqueCommands (s32v *pos) { // milos, pointer struct agument, re
 
 //--------------------------------------------------------------------------------------------------------
 /* Turn Steering right only */
+// calibration runs from the control tick as a state machine, so USB reports and serial interface keep working meanwhile
+// progress is in state (4 while running), readout with serial command S
 void BRFFB::calibrate() { // milos, we are only calibrating encoder on x-axis (even if 2 ffb axis are used)
   cal_print("cal:");
-  s32 rightGap;
-#ifdef USE_QUADRATURE_ENCODER
-  rightGap = myEnc.Read();
-#else
-#ifdef USE_AS5600
-  rightGap = as5600x.getCumulativePosition();
-#endif // end of as5600
-#endif // end of quad enc
-  s32 startpos = rightGap;
-  s32 actual = 0;
-  s32v drive; // milos, added - for setting PWM
-  drive.x = 0; // milos, added - init at zero
-#ifdef USE_TWOFFBAXIS
-  drive.y = 0; // milos, added - init at zero
-#endif // end of 2 ffb axis
+  calStep = CAL_START; // start position is taken at the next control tick
+  this->state = 4;
+}
+
+b8 BRFFB::calibrating() {
+  return (calStep != CAL_IDLE);
+}
+
+void BRFFB::calibrateDone(u8 result) {
+  calStep = CAL_IDLE;
+  this->state = result;
+  CONFIG_SERIAL.println(1); // milos, calibration procedure is done
+}
+
+s32 BRFFB::calibrateTick(s32 pos) { // one control tick of calibration, pos is x-axis encoder position, returns xFFB that turns the wheel
+  s32 drive = (MM_MAX_MOTOR_TORQUE - MM_MIN_MOTOR_TORQUE) / 4;
+  if (calStep == CAL_START) {
+    calStart = pos;
+    calLast = pos;
+    calTicks = 0;
+    calCount = 0;
+    calStep = CAL_TURN;
+    return drive;
+  }
 #ifndef USE_ZINDEX //milos, added
   /* Turn right to stop and set MAX position */
-  drive.x = (MM_MAX_MOTOR_TORQUE - MM_MIN_MOTOR_TORQUE) / 4;
-  SetPWM(&drive);
-  for (uint8_t i = 0; i < 254; i++) {
-#ifdef USE_QUADRATURE_ENCODER
-    actual = myEnc.Read();
-#else
-#ifdef USE_AS5600
-    actual = as5600x.getCumulativePosition();
-#endif // end of as5600
-#endif // end of quad enc
-    if (rightGap >= actual) {
-      break; // milos, if endstop reached
-    } else {
-      rightGap = actual;
-    }
-    delay(300);
+  if (++calTicks < CAL_STOP_TICKS) return drive;
+  calTicks = 0;
+  if (pos > calLast && ++calCount < 254) { // still turning
+    calLast = pos;
+    return drive;
   }
-  //ROTATION_MAX = rightGap; // milos, commented
-  drive.x = 0;
-  SetPWM(&drive);
+  // milos, endstop reached
 #ifndef USE_AS5600 // milos, when no AS5600
 #ifdef USE_QUADRATURE_ENCODER
   myEnc.Write(ROTATION_MAX); // milos, set quadrature encoder to right edge
 #endif // end of quad enc
 #else
-  as5600x.resetCumulativePosition(ROTATION_MAX); // milos, set magnetic encoder to right edge
+  as5600Reset(0, ROTATION_MAX); // milos, set magnetic encoder to right edge
 #endif
-  if (startpos == actual) {
+  if (calStart == pos) {
     cal_println("er");
-    this->state = 2;
+    calibrateDone(2);
   } else {
-    this->state = 1;
     cal_println("ok");  //milos
+    calibrateDone(1);
   }
 #else // milos, if z-index is used
   // milos, added Z-index lookup
   // turn right at least 1 full turn or until we encounter Z-index pulse
-#ifdef USE_QUADRATURE_ENCODER
-  startpos = myEnc.Read();
-  drive.x = (MM_MAX_MOTOR_TORQUE - MM_MIN_MOTOR_TORQUE) / 4;
-  SetPWM(&drive);
-#endif
-  for (uint8_t i = 0; i < 254; i++) {
-#ifdef USE_QUADRATURE_ENCODER
-    actual = myEnc.Read();
-#endif
-    if (zIndexFound) {
-      drive.x = 0;
-      SetPWM(&drive);
-      this->state = 1;
-      cal_println("ok");
-      break;
-    }
-    if ((actual - startpos) * ROTATION_DEG / ROTATION_MAX >= 360) {
-      drive.x = 0;
-      SetPWM(&drive);
-      this->state = 3;
-      cal_println("no z");
-      break;
-    }
-    delay(50);
+  if (zIndexFound) {
+    cal_println("ok");
+    calibrateDone(1);
+    return 0;
   }
+  if (++calTicks < CAL_ZINDEX_TICKS) return drive;
+  calTicks = 0;
+  if ((pos - calStart) * ROTATION_DEG / ROTATION_MAX < 360 && ++calCount < 254) return drive;
+  cal_println("no z");
+  calibrateDone(3);
 #endif
-  CONFIG_SERIAL.println(1); // milos, calibration procedure is done
+  return 0;
 }
 
 BRFFB::BRFFB() {
   offset = 0;
   state = 0;
+  calStep = CAL_IDLE;
 }
 
 //--------------------------------------------------------------------------------------------------------
@@ -964,11 +964,14 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_
   }
 }
 
+uint8_t hidReportSent = 0;
+
 void HID_SendReport(uint8_t id, const void* data, int len) {
   if (!tud_hid_ready()) {
+    hidReportSent = 0;
     return;
   }
-  tud_hid_report(id, data, (uint16_t)len);
+  hidReportSent = tud_hid_report(id, data, (uint16_t)len);
 }
 
 // Joystick report packing (matches Joystick_::send_16_16_12_12_12_28)
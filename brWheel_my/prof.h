@@ -0,0 +1,83 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+// Stage timing profiler for control tick stages (option USE_PROFILER)
+// Each stage boundary only takes a timestamp from a free running hardware timer and stores the stage duration,
+// on AVR Timer3 runs free at prescaler 8 (0.5us, 8 cpu cycles), but with 2 FFB axis (or DSP56ADC16S) Timer3 is taken
+// and we fall back to coarse Timer0 timing (4us, encoder stage then only lands in first couple of histogram bins).
+// min/max/mean and log2 histogram are updated later from idle passes of the main loop, outside of the tasks.
+// When the option is off PROF_BEGIN/PROF_MARK expand to nothing.
+
+#ifdef USE_PROFILER
+#define PROF_ENC     0 // encoder read
+#define PROF_FFB     1 // CalcTorqueCommands
+#define PROF_PWM     2 // SetPWM
+#define PROF_PEDALS  3 // pedal readout and scaling
+#define PROF_BUTTONS 4 // buttons and shifter
+#define PROF_REPORT  5 // SendInputReport
+#define PROF_CONFIG  6 // configCDC
+#define PROF_STAGES  7
+#define PROF_BINS    14 // histogram bin k counts durations of 2^(k-1) to 2^k - 1 timer ticks, last bin also counts all longer ones
+
+#if defined(ARDUINO_ARCH_RP2040)
+#define PROF_US(t) (t) // 1us system timer
+#elif !defined(USE_TWOFFBAXIS) && !defined(USE_DSP56ADC16S)
+#define PROF_TIMER3
+#define PROF_US(t) ((t) >> 1) // Timer3 prescaler 8 on 16MHz AVR, 0.5us per tick
+#else
+#define PROF_US(t) ((t) << 2) // Timer0 prescaler 64 on 16MHz AVR, 4us per tick
+#endif
+
+typedef struct profStat {
+  u16 min; // timer ticks
+  u16 max;
+  u32 sum;
+  u32 cnt;
+  u16 hist[PROF_BINS];
+};
+
+#if !defined(ARDUINO_ARCH_RP2040) && !defined(PROF_TIMER3)
+extern volatile unsigned long timer0_overflow_count; // Arduino core (wiring.c), low byte extends TCNT0 to 16 bits
+#endif
+extern u16 profPrev;
+extern u16 profLast[];
+extern u8 profNew;
+
+static inline u16 profStamp() { // 16 bit timer ticks, wraps after 32ms (Timer3), 65ms (RP2040) or 262ms (Timer0)
+#if defined(ARDUINO_ARCH_RP2040)
+  return (u16)time_us_32();
+#elif defined(PROF_TIMER3)
+  u8 sreg = SREG; // 16 bit timer registers share one TEMP byte, an interrupt writing OCR1x in between would corrupt the read
+  cli();
+  u16 t = TCNT3;
+  SREG = sreg;
+  return t;
+#else
+  u8 o, t;
+  do { // if Timer0 overflows in between, its interrupt runs before we check again
+    o = *(volatile u8 *)&timer0_overflow_count;
+    t = TCNT0;
+  } while (o != *(volatile u8 *)&timer0_overflow_count);
+  return ((u16)o << 8) | t;
+#endif
+}
+
+static inline void profBegin() {
+  profPrev = profStamp();
+}
+
+static inline void profMark(u8 s) { // stage s ends here, next stage starts
+  u16 t = profStamp();
+  profLast[s] = t - profPrev;
+  profPrev = t;
+  profNew |= (1 << s);
+}
+
+#define PROF_BEGIN()  profBegin()
+#define PROF_MARK(s)  profMark(s)
+#else // if no profiler
+#define PROF_BEGIN()
+#define PROF_MARK(s)
+#endif // end of profiler
+
+#endif // _PROF_H_
@@ -0,0 +1,83 @@
+#include "Config.h"
+
+#ifdef USE_PROFILER
+#include "prof.h"
+
+//--------------------------------------- Globals --------------------------------------------------------
+
+u16 profPrev; // timestamp of last stage boundary
+u16 profLast[PROF_STAGES]; // latest duration of each stage, timer ticks
+u8 profNew = 0; // bit for each stage whose latest duration is not in statistics yet
+profStat profStats[PROF_STAGES];
+
+//--------------------------------------------------------------------------------------------------------
+
+void profInit() {
+#ifdef PROF_TIMER3
+  TCCR3A = 0; // normal mode, counts 0-0xFFFF
+  TCCR3B = (1 << CS31); // prescaler 8
+  TIMSK3 = 0; // no interrupts
+#endif // end of timer3
+  profClear();
+}
+
+void profClear() {
+  memset(profStats, 0, sizeof(profStats));
+  for (u8 s = 0; s < PROF_STAGES; s++) profStats[s].min = 0xFFFF;
+  profNew = 0;
+}
+
+void profCollect() { // fold new stage durations into statistics, called when no task is due
+  u8 m = profNew;
+  profNew = 0;
+  for (u8 s = 0; m != 0; s++, m >>= 1) {
+    if (!(m & 1)) continue;
+    u16 d = profLast[s];
+    profStat *p = &profStats[s];
+    if (d < p->min) p->min = d;
+    if (d > p->max) p->max = d;
+    p->sum += d;
+    p->cnt++;
+    u8 b = 0; // number of significant bits of d
+    if (d >= 4096) {
+      b = 12;
+      d >>= 12;
+    }
+    if (d >= 256) {
+      b += 8;
+      d >>= 8;
+    }
+    if (d >= 16) {
+      b += 4;
+      d >>= 4;
+    }
+    if (d >= 4) {
+      b += 2;
+      d >>= 2;
+    }
+    if (d >= 2) {
+      b++;
+      d >>= 1;
+    }
+    b += d;
+    if (b >= PROF_BINS) b = PROF_BINS - 1;
+    if (p->hist[b] < 0xFFFF) p->hist[b]++;
+  }
+}
+
+void profDump() { // one line per stage: min max mean (us) and histogram counts
+  for (u8 s = 0; s < PROF_STAGES; s++) {
+    profStat *p = &profStats[s];
+    CONFIG_SERIAL.print((p->cnt > 0) ? PROF_US((u32)p->min) : 0);
+    CONFIG_SERIAL.print(" ");
+    CONFIG_SERIAL.print(PROF_US((u32)p->max));
+    CONFIG_SERIAL.print(" ");
+    CONFIG_SERIAL.print((p->cnt > 0) ? PROF_US(p->sum / p->cnt) : 0);
+    for (u8 b = 0; b < PROF_BINS; b++) {
+      CONFIG_SERIAL.print(" ");
+      CONFIG_SERIAL.print(p->hist[b]);
+    }
+    CONFIG_SERIAL.println();
+  }
+}
+#endif // end of profiler
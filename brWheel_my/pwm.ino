@@ -2,6 +2,14 @@
 
 #include "Config.h"
 #include "fastio_compat.h"
+#include "pwm_map.h"
+
+u8 blinkCnt = 0; // FFB clip LED toggles left of startup blink
+#ifdef USE_MCP4725
+const u8 dacAddr[2] = {0x60, 0x61}; // dac0 address pin to GND (or disconnected), dac1 address pin to VCC
+u16 dacNext[2]; // DAC codes from output stage
+u16 dacCode[2] = {0xFFFF, 0xFFFF}; // codes that DACs hold now, 0xFFFF if unknown so the next code always goes out
+#endif // end of mcp4725
 
 void InitPWM() {
   pinModeFast(DIR_PIN, OUTPUT);
@@ -11,11 +19,17 @@ void InitPWM() {
   RCM_min *= RCMscaler(pwmstate); // milos - takes into account fast pwm or phase correct mode
   RCM_zer *= RCMscaler(pwmstate); // milos
   RCM_max *= RCMscaler(pwmstate); // milos
+  pwmBind(); // select output stage for pwmstate
 #ifdef USE_MCP4725 //milos, added
-  dac0.begin(0x60); // initialize dac0
-  dac1.begin(0x61); // initialize dac1
+#ifdef USE_TWI_ASYNC
+  dacInit();
+#else // if no twi async
+  dac0.begin(dacAddr[0]); // initialize dac0
+  dac1.begin(dacAddr[1]); // initialize dac1
   dac0.setVoltage(0, true, 0); // set voltage on dac0 (save voltage after power down)
   dac1.setVoltage(0, true, 0); // set voltage on dac1 (save voltage after power down)
+  Wire.setClock(400000L); // MCP4725 supports fast mode i2C
+#endif // end of twi async
 #ifdef USE_TWOFFBAXIS
   pinModeFast(PWM_PIN_R, OUTPUT); // milos, dir pin at D10 for 2nd DAC channel in DAC+dir mode
 #endif // end of 2 ffb axis
@@ -49,14 +63,14 @@ void InitPWM() {
 
 #ifndef USE_PROMICRO
   pinMode(FFBCLIP_LED_PIN, OUTPUT); // milos, if no proMicro we can use ffb clip led
-  blinkFFBclipLED(); // milos, signals end of configuration
+  blinkCnt = 6; // milos, signals end of configuration (blinked by boot task)
 #else // for proMicro
 //#ifndef USE_CENTERBTN  // milos, we can only use it if no center button using pin 3 (for proMicro center button is on pin 2, so we skip this check)
 #ifndef USE_MCP4725 // milos, we can only use it if DAC is not using i2C pins 2,3
 #ifndef USE_ADS1015 // milos, we can only use it if ADS1015 is not using i2C pins 2,3
 #ifndef USE_AS5600 // milos, we can only use it if AS5600 is not using i2C pin 2,3
   pinMode(FFBCLIP_LED_PIN, OUTPUT); // milos, for promicro we can only use ffb clip led on D3 if not using all above
-  blinkFFBclipLED(); // milos, signals end of configuration
+  blinkCnt = 6; // milos, signals end of configuration (blinked by boot task)
 #endif // end of as5600
 #endif // end of ads1015
 #endif // end of mcp4725
@@ -65,15 +79,13 @@ void InitPWM() {
 }
 
 void blinkFFBclipLED() { // milos, added - blink FFB clip LED a few times at startup to indicate succesful boot
-  for (uint8_t i = 0; i < 3; i++) {
-    digitalWrite(FFBCLIP_LED_PIN, HIGH);
-    delay(20);
-    digitalWrite(FFBCLIP_LED_PIN, LOW);
-    delay(20);
-  }
+  if (blinkCnt == 0) return; // one LED toggle per call, called every BOOT_PERIOD by boot task
+  blinkCnt--;
+  digitalWrite(FFBCLIP_LED_PIN, (blinkCnt & 1) ? HIGH : LOW);
 }
 
 void activateFFBclipLED(s32 t) {  // milos, added - turn on FFB clip LED if max FFB signal reached (shows 90-99% of FFB signal as linear increase from 0 to 1/4 of full brightness)
+  if (blinkCnt > 0) return; // startup blink is not finished yet
   float level = 0.01 * configGeneralGain;
 #if defined(ARDUINO_ARCH_RP2040)
   if (abs(t) >= 0.9 * MM_MAX_MOTOR_TORQUE * level) {
@@ -92,6 +104,330 @@ void activateFFBclipLED(s32 t) {  // milos, added - turn on FFB clip LED if max
 #endif
 }
 
+#ifdef USE_TORQUE_LUT
+#define PWM_MIN_TORQUE 0 // min torque is the first point of torque curve
+#define PWM_MIN_PP     0.0
+#else
+#define PWM_MIN_TORQUE MM_MIN_MOTOR_TORQUE
+#define PWM_MIN_PP     minTorquePP
+#endif // end of torque lut
+
+// output stage for current pwmstate is picked by pwmBind(), together with integer map coefficients for each output and sign of torque,
+// so per tick there are no pwmstate bit checks and no float math, only a multiply and shift per output
+// pwmBind() has to be called again whenever pwmstate, FFB balance or min/max torque is changed (maps are in pwm_map.h)
+void pwmOutNone(s32v *torque) {}
+pwmStage pwmOut = pwmOutNone;
+
+#define PWM_SIGN(t) (((t) > 0) - ((t) < 0) + 1) // index into pwmMaps
+
+static inline u32 pwmAbs(s32 t) { // torque magnitude, limited so that magnitude * gain fits in 32bit
+  u32 a = abs(t);
+  return (a > MM_MAX_MOTOR_TORQUE) ? MM_MAX_MOTOR_TORQUE : a;
+}
+
+#ifdef USE_MCP4725 //milos, added - FFB signal as analog external DAC output (uses 2x MCP4725 i2C 12bit chips)
+// output stage only sets new DAC codes, dacService() sends the ones that changed with MCP4725 fast write command (2 bytes, no register address),
+// with USE_TWI_ASYNC they are queued to twi engine right after the tick and TWI interrupt sends them in the background (behind batches that are
+// already queued), while the report task runs
+#ifdef USE_TWI_ASYNC
+volatile u8 dacStatus = TWI_DONE; // result of last background DAC writes
+b8 dacPending = false; // true while DAC writes are queued or on i2C bus
+
+void dacInit() { // write 0 to DAC register and EEPROM of both DACs (what setVoltage(0, true) of MCP4725 library does)
+  for (u8 ch = 0; ch < 2; ch++) {
+    twiJob *j = twiNewJob(dacAddr[ch]);
+    if (j == NULL) return;
+    j->wbuf[0] = 0x60; // write DAC register and EEPROM
+    j->wbuf[1] = 0;
+    j->wbuf[2] = 0;
+    j->nw = 3;
+  }
+  twiGo(&dacStatus);
+  twiWait(&dacStatus);
+}
+#endif // end of twi async
+
+void dacService() {
+#ifdef USE_TWI_ASYNC
+  if (dacPending) {
+    if (dacStatus == TWI_PENDING) return; // last codes are still on their way, new ones go out next loop pass
+    dacPending = false;
+    if (dacStatus == TWI_FAILED) { // send them again with the next update
+      dacCode[0] = 0xFFFF;
+      dacCode[1] = 0xFFFF;
+    }
+  }
+  if (dacNext[0] == dacCode[0] && dacNext[1] == dacCode[1]) return;
+  for (u8 ch = 0; ch < 2; ch++) {
+    u16 v = min(dacNext[ch], 4095);
+    if (v == dacCode[ch]) continue;
+    twiJob *j = twiNewJob(dacAddr[ch]);
+    if (j == NULL) break; // queue full, code stays different from dacNext and is sent next time
+    j->wbuf[0] = v >> 8; // fast write, power down bits at 0 (normal mode)
+    j->wbuf[1] = v & 0xFF;
+    j->nw = 2;
+    dacCode[ch] = v;
+    dacPending = true;
+  }
+  if (dacPending) twiGo(&dacStatus);
+#else // if no twi async
+  for (u8 ch = 0; ch < 2; ch++) {
+    u16 v = min(dacNext[ch], 4095);
+    if (v == dacCode[ch]) continue;
+    Wire.beginTransmission(dacAddr[ch]);
+    Wire.write(v >> 8); // fast write, power down bits at 0 (normal mode)
+    Wire.write(v & 0xFF);
+    dacCode[ch] = (Wire.endTransmission() == 0) ? v : 0xFFFF;
+  }
+#endif // end of twi async
+}
+
+void dacOutAB(s32v *torque) { // dac+-, dac0-50-100 and disabled dac, both DACs follow xFFB (2nd one may be constant)
+  u8 s = PWM_SIGN(torque->x);
+  u32 a = pwmAbs(torque->x);
+  dacNext[0] = pwmMapOut(&pwmMaps[0][s], a, 0);
+  dacNext[1] = pwmMapOut(&pwmMaps[1][s], a, 1);
+}
+
+void dacOutDir(s32v *torque) { // dac+dir, dir pin gives sign of xFFB
+  digitalWriteFast(DIR_PIN, torque->x >= 0);
+  dacOutAB(torque);
+}
+
+#ifdef USE_TWOFFBAXIS
+void dacOut2AB(s32v *torque) { // 2ch dac0-50-100, xFFB on 1st DAC, yFFB on 2nd DAC
+  dacNext[0] = pwmMapOut(&pwmMaps[0][PWM_SIGN(torque->x)], pwmAbs(torque->x), 0);
+  dacNext[1] = pwmMapOut(&pwmMaps[0][PWM_SIGN(torque->y)], pwmAbs(torque->y), 1);
+}
+
+void dacOut2Dir(s32v *torque) { // 2ch dac+dir, yFFB direction on D10
+  digitalWriteFast(DIR_PIN, torque->x >= 0);
+  digitalWriteFast(PWM_PIN_R, torque->y >= 0);
+  dacOut2AB(torque);
+}
+#endif // end of 2 ffb axis
+
+void pwmBind() {
+  s32 M = MM_MAX_MOTOR_TORQUE;
+  s32 lo = PWM_MIN_PP * M;
+  s32 mid = M >> 1;
+  pwmBalance();
+#ifdef USE_PWM_DITHER
+  pwmDitherSet(bitRead(pwmstate, 7) && bitRead(PWM_DITHER_MODES, pwmModeIndex(pwmstate, true)));
+#endif // end of pwm dither
+  if (bitRead(pwmstate, 7)) { // if DAC out enabled (pwmstate bit7=1)
+    if (!bitRead(pwmstate, 6)) { // if DAC+- mode enabled (pwmstate bit6=0)
+      if (!bitRead(pwmstate, 5)) { // if (pwmstate bit5=0)
+        // milos, if we use 1 or 2 FFB axis we have dac+- mode (for 1 ffb axis it's gona be only on xFFB)
+        pwmSetConst(0, 0);
+        pwmSetConst(1, 0);
+        pwmSetMap(0, 0, lo, L_bal * M); // left force is scaled from min to max
+        pwmSetMap(1, 2, lo, R_bal * M); // right force is scaled from min to max
+        pwmOut = dacOutAB;
+      } else { // milos, if DAC0.50.100 mode (pwmstate bit5=1, bit6=0)
+        pwmSetMap(0, 0, mid - PWM_MIN_TORQUE, 0);
+        pwmSetMap(0, 1, mid, mid); // zero torque gives half range
+        pwmSetMap(0, 2, mid + PWM_MIN_TORQUE, M);
+        pwmSetConst(1, mid); // milos, set 2nd dac at half range (for 1 FFB axis)
+#ifndef USE_TWOFFBAXIS
+        pwmOut = dacOutAB;
+#else // if 2 ffb axis and mcp4725
+        pwmOut = dacOut2AB;
+#endif // end of 2 ffb axis
+      }
+    } else { // if DAC+DIR enabled (pwmstate bit6=1)
+      for (u8 i = 0; i < 3; i++) pwmSetMap(0, i, lo, M);
+      pwmSetConst(1, 0); // keep 2nd DAC at zero (for 1 FFB axis)
+#ifndef USE_TWOFFBAXIS
+      pwmOut = dacOutDir;
+#else // if 2 ffb axis and mcp4725
+      pwmOut = dacOut2Dir;
+#endif // end of 2 ffb axis
+    }
+  } else { // milos, if bit7 of pwmstate is LOW, disable dac output
+    s32 dacZeroOut = 0;
+    if (!bitRead(pwmstate, 6) && bitRead(pwmstate, 5)) dacZeroOut = mid; // milos, for dac0-50.100 mode, zero output is at half range
+    pwmSetConst(0, dacZeroOut);
+    pwmSetConst(1, dacZeroOut);
+    pwmOut = dacOutAB;
+  }
+}
+#else // milos, no mcp4725 - output FFB as PWM signals
+#ifdef USE_PWM_SYNC
+// output stage only stages new duty and dir pin level, timer1 interrupt at TOP applies them together at the pwm period boundary
+// ICF1 is set at TOP in both modes (ICR1 is TOP), TOV1 would come at BOTTOM in phase correct mode, in the middle of the centred pulse
+// compare registers are double buffered and latch at the boundary that has just passed, so new duty starts one period after the interrupt,
+// dir pin is switched at TOP where output is off, when force direction reverses, output is first held at zero for PWM_DEADTIME periods
+volatile u16 pwmSyncA, pwmSyncB; // staged compare values
+volatile u8 pwmSyncDir; // staged dir pin level, or PWM_KEEP
+volatile u8 pwmSyncRev; // staged direction of force (0 or 1), or PWM_NO_DRIVE
+u8 pwmRev = PWM_NO_DRIVE; // direction of force that is on the outputs now
+u8 pwmDead = 0; // remaining periods of deadtime
+
+void pwmSyncSet(u16 a, u16 b, u8 dir, u8 rev) {
+  if (a > TOP) a = TOP;
+  if (b > TOP) b = TOP;
+  noInterrupts();
+  pwmSyncA = a;
+  pwmSyncB = b;
+  pwmSyncDir = dir;
+  pwmSyncRev = rev;
+  if (!(TIMSK1 & _BV(ICIE1))) {
+    TIFR1 = _BV(ICF1); // forget old TOP flag, so we apply at the coming boundary and not in the middle of a period
+    TIMSK1 |= _BV(ICIE1);
+  }
+  interrupts();
+}
+
+ISR(TIMER1_CAPT_vect) { // pwm period boundary (TOP), only enabled while there is something to apply
+  if (pwmDead) {
+    if (--pwmDead) return; // outputs are still held at zero
+  } else if (pwmSyncRev != PWM_NO_DRIVE && pwmRev != PWM_NO_DRIVE && pwmSyncRev != pwmRev) { // direction reversal, turn off first
+    OCR1A = 0;
+    OCR1B = 0;
+    pwmRev = PWM_NO_DRIVE;
+    pwmDead = PWM_DEADTIME + 1; // zero duty only latches at next boundary, then count full zero periods
+    return;
+  }
+  if (pwmSyncDir != PWM_KEEP) digitalWriteFast(DIR_PIN, pwmSyncDir);
+  OCR1A = pwmSyncA;
+  OCR1B = pwmSyncB;
+  pwmRev = pwmSyncRev;
+  TIMSK1 &= ~_BV(ICIE1); // nothing left to apply
+}
+#endif // end of pwm sync
+
+static inline void pwmOutX(s32v *torque, u8 dir, u8 rev) { // xFFB on D9 and D10, dir pin level (or PWM_KEEP) and force direction come from output mode
+  u8 s = PWM_SIGN(torque->x);
+  u32 a = pwmAbs(torque->x);
+#ifdef USE_PWM_SYNC
+  pwmSyncSet(pwmMapOut(&pwmMaps[0][s], a, 0), pwmMapOut(&pwmMaps[1][s], a, 1), dir, rev);
+#else
+  if (dir != PWM_KEEP) digitalWriteFast(DIR_PIN, dir);
+  PWM16A(pwmMapOut(&pwmMaps[0][s], a, 0));
+  PWM16B(pwmMapOut(&pwmMaps[1][s], a, 1));
+#endif // end of pwm sync
+}
+
+void pwmOutAB(s32v *torque) { // pwm0-50-100 and rcm on D9 (D10 is constant)
+  pwmOutX(torque, PWM_KEEP, PWM_NO_DRIVE);
+}
+
+#ifndef USE_TWOFFBAXIS
+void pwmOutPM(s32v *torque) { // pwm+-, left force on D9, right force on D10
+  // use dir pin as BTS7960 pwm motor enable signal, disable it when no pwm signal to make it rotate freely
+  pwmOutX(torque, torque->x != 0, (torque->x != 0) ? (torque->x > 0) : PWM_NO_DRIVE);
+}
+
+void pwmOutDir(s32v *torque) { // pwm+dir
+  pwmOutX(torque, torque->x >= 0, torque->x >= 0);
+}
+#else // milos, if we use 2 FFB axis
+void pwmOut2PM(s32v *torque) { // 2ch pwm+-, xFFB on D9 (left) and D10 (right), yFFB on D11 (up) and D5 (down)
+  pwmOutAB(torque);
+  u8 s = PWM_SIGN(torque->y);
+  u32 a = pwmAbs(torque->y);
+  PWM16C(pwmMapOut(&pwmMaps[1][s], a, 2));
+  PWM16D(pwmMapOut(&pwmMaps[0][s], a, 3));
+}
+
+#ifndef USE_TCA9548 // milos, only available if not using 2 mag encoders via i2C multilexer
+void pwmOut2AB(s32v *torque) { // 2ch pwm0-50-100 and 2ch pwm+dir, xFFB on D9, yFFB on D10
+  PWM16A(pwmMapOut(&pwmMaps[0][PWM_SIGN(torque->x)], pwmAbs(torque->x), 0));
+  PWM16B(pwmMapOut(&pwmMaps[0][PWM_SIGN(torque->y)], pwmAbs(torque->y), 1));
+}
+
+void pwmOut2Dir(s32v *torque) { // 2ch pwm+dir, xFFB direction on D11, yFFB direction on D5
+  digitalWriteFast(PWM_PIN_U, torque->x >= 0);
+  digitalWriteFast(PWM_PIN_D, torque->y >= 0);
+  pwmOut2AB(torque);
+}
+#endif // end of tca
+#endif // end of 2 ffb axis
+
+void pwmBind() {
+  s32 M = MM_MAX_MOTOR_TORQUE;
+  s32 mid = M >> 1;
+  pwmBalance();
+#ifdef USE_PWM_DITHER
+  pwmDitherSet(bitRead(PWM_DITHER_MODES, pwmModeIndex(pwmstate, false)));
+#endif // end of pwm dither
+  pwmSetConst(0, 0);
+  pwmSetConst(1, 0);
+#ifndef USE_TWOFFBAXIS // milos, if we use 1 FFB axis
+  if (!bitRead(pwmstate, 1)) { // if pwmstate bit1=0
+    if (!bitRead(pwmstate, 6)) { // if PWM+- mode (pwmstate bit1=0, bit6=0)
+      pwmSetMap(0, 0, PWM_MIN_TORQUE, L_bal * M);
+      pwmSetMap(1, 2, PWM_MIN_TORQUE, R_bal * M);
+      pwmOut = pwmOutPM;
+    } else { // if PWM0.50.100 mode (pwmstate bit1=0 and bit6=1)
+      pwmSetMap(0, 0, mid - PWM_MIN_TORQUE, 0);
+      pwmSetMap(0, 1, mid, mid); // zero torque gives half range
+      pwmSetMap(0, 2, mid + PWM_MIN_TORQUE, M);
+      pwmOut = pwmOutAB;
+    }
+  } else { // if pwmstate bit1=1
+    if (!bitRead(pwmstate, 6)) { // if PWM+dir mode (pwmstate bit1=1, bit6=0)
+      for (u8 i = 0; i < 3; i++) pwmSetMap(0, i, PWM_MIN_TORQUE, M);
+      pwmOut = pwmOutDir;
+    } else { // if RCM mode (pwmstate bit1=1, bit6=1)
+      pwmSetMap(0, 0, RCM_zer * (1.0 - PWM_MIN_PP), RCM_min);
+      pwmSetMap(0, 1, RCM_zer, RCM_zer); // zero torque gives zero pulse width
+      pwmSetMap(0, 2, RCM_zer * (1.0 + PWM_MIN_PP), RCM_max);
+      pwmOut = pwmOutAB;
+    }
+    pwmSetConst(1, RCM_zer);
+  }
+#else // milos, if we use 2 FFB axis
+  if (!bitRead(pwmstate, 1)) { // if pwmstate bit1=0
+    if (!bitRead(pwmstate, 6)) { // if 2CH PWM+- mode (pwmstate bit1=0, bit6=0)
+      pwmSetMap(0, 0, PWM_MIN_TORQUE, M);
+      pwmSetMap(1, 2, PWM_MIN_TORQUE, M);
+      pwmOut = pwmOut2PM;
+    } else {  // milos, 2CH PWM0.50.100 mode (pwmstate bit1=0, bit6=1)
+#ifndef USE_TCA9548 // milos, only available if not using 2 mag encoders via i2C multilexer
+      pwmSetMap(0, 0, mid - PWM_MIN_TORQUE, 0);
+      pwmSetMap(0, 1, mid, mid); // zero torque gives half range
+      pwmSetMap(0, 2, mid + PWM_MIN_TORQUE, M);
+      pwmOut = pwmOut2AB;
+#else
+      pwmOut = pwmOutNone;
+#endif // end of tca
+    }
+  } else { // milos, if pwmstate bit1=1
+#ifndef USE_TCA9548 // milos, only available if not using 2 mag encoders via i2C multilexer
+    if (!bitRead(pwmstate, 6)) { // milos, if 2CH PWM+DIR mode (pwmstate bit1=1, bit6=0)
+      for (u8 i = 0; i < 3; i++) pwmSetMap(0, i, PWM_MIN_TORQUE, M);
+      pwmOut = pwmOut2Dir;
+    } else { // milos, 2CH RCM mode is not implemented (not enough memory), outputs are only zeroed
+      pwmSetConst(0, RCM_zer);
+      pwmSetConst(1, RCM_zer);
+      pwmOut = pwmOutAB;
+    }
+#else
+    pwmOut = pwmOutNone;
+#endif // end of tca
+  }
+#endif // end of 2 ffb axis
+}
+#endif // end of use mcp4275
+
+void pwmBalance() { // left and right force multipliers from FFB balance slider
+#ifndef USE_LOAD_CELL // milos, only allow FFB balance if not using load cell
+  FFB_bal = (f32)(LC_scaling - 128) / 255.0; // milos, max value is 0.5
+  if (FFB_bal >= 0) {
+    L_bal = 1.0 - FFB_bal;
+    R_bal = 1.0;
+  } else {
+    L_bal = 1.0;
+    R_bal = 1.0 + FFB_bal;
+  }
+#else // otherwise just set both at max
+  L_bal = 1.0;
+  R_bal = 1.0;
+#endif // end of load cell
+}
+
 //void SetPWM (s32 torque)  { //torque between -MM_MAX_MOTOR and +MM_MAX_MOTOR // milos, torque is xFFB, while yFFB is passed from torqueY global variable outside of this function
 void SetPWM (s32v *torque) { // milos, takes pointer struct as argument - 2 axis FFB data
   if (torque != NULL) { // milos, this check is always required for pointers
@@ -109,242 +445,214 @@ void SetPWM (s32v *torque) { // milos, takes pointer struct as argument - 2 axis
 //#endif // end of center button
 #endif // end of proMicro
 
-#ifndef USE_LOAD_CELL // milos, only allow FFB balance if not using load cell
-    FFB_bal = (f32)(LC_scaling - 128) / 255.0; // milos, max value is 0.5
-    if (FFB_bal >= 0) {
-      L_bal = 1.0 - FFB_bal;
-      R_bal = 1.0;
-    } else if (FFB_bal < 0) {
-      L_bal = 1.0;
-      R_bal = 1.0 + FFB_bal;
-    }/* else {
-      L_bal = 1.0;
-      R_bal = 1.0;
-    }*/
-#else // otherwise just set both at max
-    L_bal = 1.0;
-    R_bal = 1.0;
-#endif // end of load cell
-
-#ifdef USE_MCP4725 //milos, added - FFB signal as analog external DAC output (uses 2x MCP4725 i2C 12bit chips)
-    if (bitRead(pwmstate, 7)) { // if DAC out enabled (pwmstate bit7=1)
-      if (!bitRead(pwmstate, 6)) { // if DAC+- mode enabled (pwmstate bit6=0)
-        if (!bitRead(pwmstate, 5)) { // if (pwmstate bit5=0)
-          // milos, if we use 1 or 2 FFB axis we have dac+- mode (for 1 ffb axis it's gona be only on xFFB)
-          if (torque->x > 0) {
-            dac0.setVoltage(0, false, 0); // left force is 0
-            dac1.setVoltage(map(torque->x, 0, MM_MAX_MOTOR_TORQUE, minTorquePP * MM_MAX_MOTOR_TORQUE, R_bal * MM_MAX_MOTOR_TORQUE), false, 0); // right force is scaled from min to max
-          } else if (torque->x < 0) {
-            dac0.setVoltage(map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, minTorquePP * MM_MAX_MOTOR_TORQUE, L_bal * MM_MAX_MOTOR_TORQUE), false, 0); // left force is scaled from min to max
-            dac1.setVoltage(0, false, 0); // right force is 0
-          } else {
-            dac0.setVoltage(0, false, 0);
-            dac1.setVoltage(0, false, 0);
-          }
-        } else { // milos, if DAC0.50.100 mode (pwmstate bit5=1, bit6=0)
-          if (torque->x > 0) {
-            torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) + MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-            dac0.setVoltage(torque->x, false, 0);
-          } else if (torque->x < 0) {
-            torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) - MM_MIN_MOTOR_TORQUE, 0);
-            dac0.setVoltage(torque->x, false, 0);
-          } else {
-            dac0.setVoltage(MM_MAX_MOTOR_TORQUE / 2, false, 0);
-          }
-#ifndef USE_TWOFFBAXIS // milos, if we use 1 FFB axis for dac0-50-100 mode
-          dac1.setVoltage(MM_MAX_MOTOR_TORQUE >> 1, false, 0); // milos, set 2nd dac at half range
-#else // if 2 ffb axis and mcp4725
-          if (torque->y > 0) {
-            torque->y = map(torque->y, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) + MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-            dac1.setVoltage(torque->y, false, 0);
-          } else if (torque->y < 0) {
-            torque->y = map(-torque->y, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) - MM_MIN_MOTOR_TORQUE, 0);
-            dac1.setVoltage(torque->y, false, 0);
-          } else {
-            dac1.setVoltage(MM_MAX_MOTOR_TORQUE / 2, false, 0);
-          }
-#endif // end of 2 ffb axis
-        }
-      } else { // if DAC+DIR enabled (pwmstate bit6=1)
-        if (torque->x >= 0) {
-          digitalWriteFast(DIR_PIN, HIGH);
-        } else {
-          digitalWriteFast(DIR_PIN, LOW);
-        }
-        torque->x = map(abs(torque->x), 0, MM_MAX_MOTOR_TORQUE, minTorquePP * MM_MAX_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-        dac0.setVoltage(torque->x, false, 0); // update 1st DAC
-#ifndef USE_TWOFFBAXIS // milos, if we use 1 FFB axis
-        dac1.setVoltage(0, false, 0); // keep 2nd DAC at zero
-#else // if 2 ffb axis and mcp4725
-        // milos, 2CH DAC+DIR mode
-        if (torque->y >= 0) {
-          digitalWriteFast(PWM_PIN_R, HIGH); // milos, positive force (up)
-        } else {
-          digitalWriteFast(PWM_PIN_R, LOW); // milos, negative force (down)
-        }
-        torque->y = map(abs(torque->y), 0, MM_MAX_MOTOR_TORQUE, minTorquePP * MM_MAX_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-        dac1.setVoltage(torque->y, false, 0); // update 2nd DAC
+#ifdef USE_COGGING
+    cogApply(torque); // adds cogging and friction compensation to xFFB, or replaces it while learning
+#endif // end of cogging
+#ifdef USE_TORQUE_LUT
+    torque->x = linearizeTorque(torque->x);
+#ifdef USE_TWOFFBAXIS
+    torque->y = linearizeTorque(torque->y);
 #endif // end of 2 ffb axis
-      }
-    } else { // milos, if bit7 of pwmstate is LOW, disable dac output
-      int16_t dacZeroOut = 0;
-      if (!bitRead(pwmstate, 6) && bitRead(pwmstate, 5)) dacZeroOut = MM_MAX_MOTOR_TORQUE >> 1; // milos, for dac0-50.100 mode, zero output is at half range
-      dac0.setVoltage(dacZeroOut, false, 0); // zero 1st DAC
-      dac1.setVoltage(dacZeroOut, false, 0); // zero 2nd DAC
+#endif // end of torque lut
+    pwmOut(torque);
+#ifdef USE_MCP4725
+    dacService(); // send new DAC codes
+#endif // end of mcp4725
+  }
+}
+
+#ifdef USE_TORQUE_LUT
+u16 tlutMax = 0; // MM_MAX_MOTOR_TORQUE that tlutScale was calculated for
+u32 tlutScale; // (TORQUE_LUT_POINTS - 1) / MM_MAX_MOTOR_TORQUE with 16 fractional bits, no division per tick
+
+void linearTorqueLut() { // straight line from min torque to full torque
+  u16 lo = 0;
+  if (MM_MAX_MOTOR_TORQUE > 0) lo = ((u32)MM_MIN_MOTOR_TORQUE << TORQUE_LUT_BITS) / MM_MAX_MOTOR_TORQUE;
+  for (u8 k = 0; k < TORQUE_LUT_POINTS; k++) {
+    torqueLut[k] = lo + ((u32)(TORQUE_LUT_ONE - lo) * k) / (TORQUE_LUT_POINTS - 1);
+  }
+}
+
+// torque magnitude is looked up in torque curve and interpolated, sign is kept and zero torque stays zero
+// so the first point lifts small forces over motor and driver deadzone and the rest can undo high end compression
+s32 linearizeTorque(s32 t) {
+  if (t == 0) return 0;
+  if (MM_MAX_MOTOR_TORQUE != tlutMax) {
+    tlutMax = MM_MAX_MOTOR_TORQUE;
+    tlutScale = (((u32)(TORQUE_LUT_POINTS - 1) << 16) + tlutMax - 1) / tlutMax; // rounded up, so full torque reaches the last point
+  }
+  u32 m = abs(t);
+  if (m > tlutMax) m = tlutMax;
+  u32 pos = (m * tlutScale) >> 8; // segment in upper bits, 8 bit fraction
+  u8 seg = pos >> 8;
+  s32 y;
+  if (seg >= TORQUE_LUT_POINTS - 1) {
+    y = torqueLut[TORQUE_LUT_POINTS - 1];
+  } else {
+    s32 a = torqueLut[seg];
+    y = a + (((torqueLut[seg + 1] - a) * (s32)(pos & 0xFF)) >> 8);
+  }
+  y = (y * tlutMax) >> TORQUE_LUT_BITS;
+  return (t > 0) ? y : -y;
+}
+#endif // end of torque lut
+
+#ifdef USE_COGGING
+// cogging and friction compensation, correction is looked up by raw encoder position within one motor revolution
+// (linear interpolation between bins) and added to xFFB ahead of torque curve, friction part follows direction of motion
+// and fades in with speed so it does not chatter at rest. Map is learned by a slow position controlled sweep of one motor
+// revolution each way, torque needed to follow the sweep is cogging plus friction, the two directions separate them.
+#define COG_SETTLE_TICKS 250 // hold start position for 0.5s before sweeping
+#define COG_RUNIN        ((1 << COG_LEARN_BITS) >> 3) // ticks at start of each sweep that are not sampled (wheel catching up)
+#define COG_MAX_CNT      127 // samples are at most 1/4 of full torque (COG_ONE / 4), so 127 of them fit s16
+
+s32 cogCpr = 0; // CPR that cogCpm and cogScale were calculated for
+s32 cogCpm; // encoder counts per motor revolution
+u32 cogScale; // 2^31 / cogCpm, phase times scale is position within motor revolution in 31 bits, no division per tick
+s32 cogPhase; // raw position within motor revolution, 0 to cogCpm - 1
+s32 cogLast; // raw position at last tick
+s16 cogSpeed; // filtered speed in counts per tick, 4 fractional bits
+b8 cogLearned = false; // map was learned in this session, so it is aligned with the motor even without z-index
+u8 cogState = COG_IDLE;
+s32 cogOrigin; // learning sweep start position
+u16 cogTicks; // ticks since start of current learning state
+u32 cogKp; // learning position gain, torque per count with 8 fractional bits
+s32 cogInteg; // learning position loop integrator
+s16 cogSum[COG_BINS]; // learning torque sums for each bin, in 1/COG_ONE of full torque
+u8 cogCnt[COG_BINS]; // samples in each bin, at most COG_MAX_CNT so that sums fit 16 bits
+s32 cogFricSum; // learning torque sum signed by sweep direction
+u16 cogFricCnt;
+
+void cogClear() {
+  memset(cogMap, 0, sizeof(cogMap));
+  cogFric = 0;
+}
+
+void cogRescale() { // encoder counts per motor revolution changed, restart phase tracking
+  cogCpr = CPR;
+  cogCpm = max(CPR / COG_RATIO, (s32)COG_BINS);
+  cogScale = (1UL << 31) / cogCpm;
+  cogLast = myEnc.ReadRaw();
+  cogPhase = cogLast % cogCpm;
+  if (cogPhase < 0) cogPhase += cogCpm;
+  cogSpeed = 0;
+}
+
+b8 cogLearning() {
+  return (cogState >= COG_SETTLE && cogState <= COG_REV);
+}
+
+b8 cogStart() { // start learning sweep, wheel must be free to turn about one motor revolution each way
+  if (cogLearning() || MM_MAX_MOTOR_TORQUE == 0) return false;
+#ifdef USE_ZINDEX
+  if (!zIndexFound) return false; // map has to be referenced to index pulse, otherwise it is lost at next powerup
+#endif // end of zindex
+  cogRescale();
+  cogKp = ((u32)MM_MAX_MOTOR_TORQUE << 12) / cogCpm; // learning torque limit is reached at 1/64 revolution error
+  cogOrigin = cogLast;
+  cogInteg = 0;
+  cogTicks = 0;
+  memset(cogSum, 0, sizeof(cogSum));
+  memset(cogCnt, 0, sizeof(cogCnt));
+  cogFricSum = 0;
+  cogFricCnt = 0;
+  cogState = COG_SETTLE;
+  return true;
+}
+
+static void cogFinish() { // bin average minus overall average is cogging, half the difference between directions is friction
+  s32 mean = 0;
+  u16 n = 0;
+  for (u16 b = 0; b < COG_BINS; b++) {
+    if (cogCnt[b] > 0) {
+      cogSum[b] /= cogCnt[b];
+      mean += cogSum[b];
+      n++;
     }
-#else // milos, no mcp4725 - output FFB as PWM signals
-#ifndef USE_TWOFFBAXIS // milos, if we use 1 FFB axis
-    if (!bitRead(pwmstate, 1)) { // if pwmstate bit1=0
-      if (!bitRead(pwmstate, 6)) { // if PWM+- mode (pwmstate bit1=0, bit6=0)
-        if (torque->x > 0) {
-          torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, R_bal * MM_MAX_MOTOR_TORQUE);
-          PWM16A(0);
-          PWM16B(torque->x);
-          digitalWriteFast(DIR_PIN, HIGH); //use dir pin as BTS7960 pwm motor enable signal
-        } else if (torque->x < 0) {
-          torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, L_bal * MM_MAX_MOTOR_TORQUE);
-          PWM16A(torque->x);
-          PWM16B(0);
-          digitalWriteFast(DIR_PIN, HIGH);
-        } else {
-          PWM16A(0);
-          PWM16B(0);
-          digitalWriteFast(DIR_PIN, LOW); // disable bts output when no pwm signal to make it rotate freely
-        }
-      } else { // if PWM0.50.100 mode (pwmstate bit1=0 and bit6=1)
-        if (torque->x > 0) {
-          torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE / 2 + MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16A(torque->x);
-        } else if (torque->x < 0) {
-          torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE / 2 - MM_MIN_MOTOR_TORQUE, 0);
-          PWM16A(torque->x);
-        } else {
-          PWM16A(MM_MAX_MOTOR_TORQUE / 2);
-        }
-        PWM16B(0);
-      }
-    } else if (bitRead(pwmstate, 1)) { // if pwmstate bit1=1
-      if (!bitRead(pwmstate, 6)) { // if PWM+dir mode (pwmstate bit1=1, bit6=0)
-        if (torque->x >= 0) {
-          digitalWriteFast(DIR_PIN, HIGH);
-        } else {
-          digitalWriteFast(DIR_PIN, LOW);
-        }
-        torque->x = map(abs(torque->x), 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-        PWM16A(torque->x);
-      } else { // if RCM mode (pwmstate bit1=1, bit6=1)
-        if (torque->x > 0) {
-          torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, RCM_zer * (1.0 + minTorquePP), RCM_max);
-          PWM16A(torque->x);
-        } else if (torque->x < 0) {
-          torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, RCM_zer * (1.0 - minTorquePP), RCM_min);
-          PWM16A(torque->x);
-        } else {
-          PWM16A(RCM_zer);
-        }
-      }
-      PWM16B(RCM_zer);
-      //digitalWriteFast(PWM_PIN_R, LOW);
+  }
+  if (n > 0) mean /= n;
+  for (u16 b = 0; b < COG_BINS; b++) {
+    cogMap[b] = (cogCnt[b] > 0) ? constrain(cogSum[b] - mean, -127, 127) : 0;
+  }
+  s32 f = (cogFricCnt > 0) ? cogFricSum / cogFricCnt : 0;
+  cogFric = constrain((f << COG_ONE_BITS) / (s32)MM_MAX_MOTOR_TORQUE, 0, 254);
+  cogLearned = true;
+  cogState = COG_IDLE;
+}
+
+static s32 cogLearn() { // one tick of learning sweep, returns xFFB that moves the wheel
+  s32 lim = MM_MAX_MOTOR_TORQUE >> 2;
+  s32 target = cogOrigin;
+  if (cogState == COG_FWD) target += ((int64_t)cogTicks * cogCpm) >> COG_LEARN_BITS;
+  if (cogState == COG_REV) target -= ((int64_t)cogTicks * cogCpm) >> COG_LEARN_BITS;
+  s32 e = constrain(target - cogLast, -(cogCpm >> 3), cogCpm >> 3);
+  if (cogState != COG_SETTLE && abs(e) >= (cogCpm >> 3)) { // wheel is blocked or motor is too weak
+    cogState = COG_FAIL;
+    return 0;
+  }
+  s32 v = 0; // target speed, counts per tick with 4 fractional bits
+  if (cogState == COG_FWD) v = (cogCpm << 4) >> COG_LEARN_BITS;
+  if (cogState == COG_REV) v = -((cogCpm << 4) >> COG_LEARN_BITS);
+  s32 x = constrain((e << 3) + v - cogSpeed, -cogCpm, cogCpm); // speed error term damps the loop
+  s32 p = (x * (s32)cogKp) >> 11;
+  cogInteg = constrain(cogInteg + (p >> 4), -lim, lim);
+  s32 t = constrain(p + cogInteg, -lim, lim);
+  if (cogState == COG_SETTLE) {
+    if (++cogTicks >= COG_SETTLE_TICKS) {
+      cogTicks = 0;
+      cogState = COG_FWD;
     }
-#else // milos, if we use 2 FFB axis
-    if (!bitRead(pwmstate, 1)) { // if pwmstate bit1=0
-      if (!bitRead(pwmstate, 6)) { // if 2CH PWM+- mode (pwmstate bit1=0, bit6=0)
-        if (torque->x > 0) { // milos, X axis FFB, pwm+-, D9 (left), D10 (right)
-          torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16A(0);
-          PWM16B(torque->x);
-        } else if (torque->x < 0) {
-          torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16A(torque->x);
-          PWM16B(0);
-        } else {
-          PWM16A(0);
-          PWM16B(0);
-        }
-        if (torque->y >= 0) {  // milos, Y axis FFB, pwm+-, D11 (up), D5 (down)
-          torque->y = map(torque->y, 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16C(torque->y);
-          PWM16D(0);
-        } else if (torque->y < 0) {
-          torque->y = map(-torque->y, 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16C(0);
-          PWM16D(torque->y);
-        } else {
-          PWM16C(0);
-          PWM16D(0);
-        }
-      } else {  // milos, 2CH PWM0.50.100 mode (pwmstate bit1=0, bit6=1)
-#ifndef USE_TCA9548 // milos, only available if not using 2 mag encoders via i2C multilexer
-        //PWM16C(0);
-        //PWM16D(0);
-        //digitalWriteFast(PWM_PIN_D, LOW);
-        //digitalWriteFast(PWM_PIN_U, LOW);
-        if (torque->x > 0) {
-          torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) + MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16A(torque->x);
-        } else if (torque->x < 0) {
-          torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) - MM_MIN_MOTOR_TORQUE, 0);
-          PWM16A(torque->x);
-        } else {
-          PWM16A(MM_MAX_MOTOR_TORQUE / 2);
-        }
-        if (torque->y > 0) {
-          torque->y = map(torque->y, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) + MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-          PWM16B(torque->y);
-        } else if (torque->y < 0) {
-          torque->y = map(-torque->y, 0, MM_MAX_MOTOR_TORQUE, (MM_MAX_MOTOR_TORQUE >> 1) - MM_MIN_MOTOR_TORQUE, 0);
-          PWM16B(torque->y);
-        } else {
-          PWM16B(MM_MAX_MOTOR_TORQUE / 2);
-        }
-#endif // end of tca
-      }
-    } else { // milos, if pwmstate bit1=1
-#ifndef USE_TCA9548 // milos, only available if not using 2 mag encoders via i2C multilexer
-      if (!bitRead(pwmstate, 6)) { // milos, if 2CH PWM+DIR mode (pwmstate bit1=1, bit6=0)
-        if (torque->x >= 0) {
-          digitalWriteFast(PWM_PIN_U, HIGH); // milos, pin D11
-        } else {
-          digitalWriteFast(PWM_PIN_U, LOW);
-        }
-        torque->x = map(abs(torque->x), 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-        PWM16A(torque->x); // milos, use pin D9 for xFFB
-        if (torque->y >= 0) {
-          digitalWriteFast(PWM_PIN_D, HIGH); // milos, pin D5
-        } else {
-          digitalWriteFast(PWM_PIN_D, LOW);
-        }
-        torque->y = map(abs(torque->y), 0, MM_MAX_MOTOR_TORQUE, MM_MIN_MOTOR_TORQUE, MM_MAX_MOTOR_TORQUE);
-        PWM16B(torque->y); // milos, use pin D10 for yFFB
-      } else { // milos, if 2CH RCM mode (pwmstate bit1=1, bit6=1)
-        // milos, 2CH RCM mode (unfortunately, not enough memory left for it so I commented it out)
-        /*if (torque->x > 0) {
-          torque->x = map(torque->x, 0, MM_MAX_MOTOR_TORQUE, RCM_zer * (1.0 + minTorquePP), RCM_max);
-          PWM16A(torque->x);
-          } else if (torque->x < 0) {
-          torque->x = map(-torque->x, 0, MM_MAX_MOTOR_TORQUE, RCM_zer * (1.0 - minTorquePP), RCM_min);
-          PWM16A(torque->x);
-          } else {
-          PWM16A(RCM_zer);
-          }
-          if (torque->y > 0) {
-          torque->y = map(torque->y, 0, MM_MAX_MOTOR_TORQUE, RCM_zer * (1.0 + minTorquePP), RCM_max);
-          PWM16B(torque->y);
-          } else if (torque->y < 0) {
-          torque->y = map(-torque->y, 0, MM_MAX_MOTOR_TORQUE, RCM_zer * (1.0 - minTorquePP), RCM_min);
-          PWM16B(torque->y);
-          } else {
-          PWM16B(RCM_zer);
-          }*/
-        PWM16A(RCM_zer); // milos, for now only zero it out
-        PWM16B(RCM_zer);
-      }
-#endif // end of tca
+    return t;
+  }
+  if (cogTicks >= COG_RUNIN) { // sample into nearest bin
+    u16 b = (((u32)cogPhase * cogScale + (1UL << (30 - COG_BINS_BITS))) >> (31 - COG_BINS_BITS)) & (COG_BINS - 1);
+    if (cogCnt[b] < COG_MAX_CNT) {
+      cogSum[b] += (t << COG_ONE_BITS) / (s32)MM_MAX_MOTOR_TORQUE;
+      cogCnt[b]++;
+    }
+    cogFricSum += (cogState == COG_FWD) ? t : -t;
+    cogFricCnt++;
+  }
+  if (++cogTicks >= (1 << COG_LEARN_BITS) + COG_RUNIN) {
+    if (cogState == COG_FWD) {
+      cogOrigin = target;
+      cogTicks = 0;
+      cogState = COG_REV;
+    } else {
+      cogFinish();
+      return 0;
     }
-#endif // end of 2 ffb axis
-#endif // end of use mcp4275
   }
+  return t;
+}
+
+void cogApply(s32v *torque) { // fixed cost per tick, phase is tracked incrementally
+  if (CPR != cogCpr) cogRescale();
+  s32 raw = myEnc.ReadRaw();
+  s32 d = raw - cogLast;
+  cogLast = raw;
+  cogPhase += d;
+  while (cogPhase >= cogCpm) cogPhase -= cogCpm;
+  while (cogPhase < 0) cogPhase += cogCpm;
+  d = constrain(d, -2047, 2047);
+  cogSpeed += ((s16)(d << 4) - cogSpeed) >> 2;
+  if (cogLearning()) {
+    torque->x = cogLearn();
+    return;
+  }
+#ifdef USE_ZINDEX
+  if (!cogLearned && !zIndexFound) return; // map is referenced to index pulse
+#else
+  if (!cogLearned) return; // no index, so map is only aligned in the session it was learned in
+#endif // end of zindex
+  u32 ph = (u32)cogPhase * cogScale; // bin in upper COG_BINS_BITS of 31 bits, 8 bit fraction below
+  u16 b = ph >> (31 - COG_BINS_BITS);
+  s32 a = cogMap[b];
+  s32 c = a + (((cogMap[(b + 1) & (COG_BINS - 1)] - a) * (s32)((ph >> (23 - COG_BINS_BITS)) & 0xFF)) >> 8);
+  c += ((s32)cogFric * constrain(cogSpeed, -16, 16)) >> 4; // full friction from 1 count per tick
+  torque->x += (c * (s32)MM_MAX_MOTOR_TORQUE) >> COG_ONE_BITS;
 }
+#endif // end of cogging
 
 #ifndef USE_MCP4725
 #if defined(ARDUINO_ARCH_RP2040)
@@ -0,0 +1,67 @@
+#ifndef _PWM_MAP_H_
+#define _PWM_MAP_H_
+
+// Integer output maps and first order sigma-delta dither of FFB output stage (see pwmBind in pwm.ino)
+// This is pure integer code without hardware access, FirmwareExtras/tests/pwm_dither_test.cpp builds it on the host.
+// Needs u8-u32/s32/b8 types, constrain(), bitRead(), MM_MAX_MOTOR_TORQUE and USE_PWM_DITHER from Config.h.
+
+typedef struct pwmMap { // output = base +/- torque magnitude * gain, for one output and one sign of torque (see pwmBind)
+  u16 base; // output at zero torque magnitude
+  u32 gain; // output change per unit of torque magnitude, 16 fractional bits
+  u16 frac; // next 16 fractional bits of gain, only used with dither (truncated gain would bias the averaged output up to 1 LSB)
+  u32 neg; // 0 if output rises with torque, 0xFFFFFFFF if it falls
+};
+
+pwmMap pwmMaps[2][3]; // [output][torque sign: 0-negative, 1-zero, 2-positive]
+
+// index of pwmstate output mode in PWM_DITHER_MODES: 0 +-, 1 0-50-100, 2 +dir, 3 rcm
+// pwm modes are bit1:bit6 of pwmstate, dac modes are bit6 (dac+dir, bit5 is not used then) or bit5 (dac0-50-100), there is no dac rcm
+static inline u8 pwmModeIndex(u8 state, b8 dac) {
+  if (dac) return bitRead(state, 6) ? 2 : bitRead(state, 5);
+  return (bitRead(state, 1) << 1) | bitRead(state, 6);
+}
+
+#ifdef USE_PWM_DITHER
+// first order sigma-delta on output value, part of the output that is below 1 LSB is carried over to the next tick,
+// so output toggles between two neighbour values and its average keeps the resolution of torque (motor and driver filter it out)
+u16 pwmErr[4]; // remainder below 1 LSB for each output (D9/dac0, D10/dac1, D11, D5), 16 bits
+u16 pwmDitherMask; // 0xFFFF if dither is enabled for current pwmstate mode, 0 otherwise (remainder is then always dropped)
+
+void pwmDitherSet(b8 on) {
+  pwmDitherMask = on ? 0xFFFF : 0;
+  for (u8 i = 0; i < 4; i++) pwmErr[i] = 0;
+}
+#endif // end of pwm dither
+
+static inline u16 pwmMapOut(const pwmMap *m, u32 a, u8 e) { // e is output index for dither
+#ifdef USE_PWM_DITHER
+  u32 p = a * m->gain + ((a * m->frac) >> 16) + pwmErr[e]; // gain with 32 fractional bits, can not overflow since it is rounded down
+  pwmErr[e] = p & pwmDitherMask;
+  u32 d = p >> 16;
+#else
+  u32 d = (a * m->gain) >> 16;
+#endif // end of pwm dither
+  return m->base + ((d ^ m->neg) - m->neg); // conditional negate, no branch
+}
+
+void pwmSetMap(u8 out, u8 sign, s32 lo, s32 hi) { // same as map(abs(torque), 0, MM_MAX_MOTOR_TORQUE, lo, hi)
+  pwmMap *m = &pwmMaps[out][sign];
+  u32 span = abs(hi - lo);
+  m->base = constrain(lo, 0, 0xFFFF);
+#ifdef USE_PWM_DITHER
+  u16 up = pwmDitherMask ? 0 : MM_MAX_MOTOR_TORQUE - 1; // dither carries the remainder, gain must not be rounded up or output could step 1 LSB past hi
+#else
+  u16 up = MM_MAX_MOTOR_TORQUE - 1;
+#endif // end of pwm dither
+  m->gain = (MM_MAX_MOTOR_TORQUE > 0) ? ((span << 16) + up) / MM_MAX_MOTOR_TORQUE : 0; // rounded up, so full torque reaches hi
+#ifdef USE_PWM_DITHER
+  m->frac = (pwmDitherMask && MM_MAX_MOTOR_TORQUE > 0) ? ((((span << 16) % MM_MAX_MOTOR_TORQUE) << 16) / MM_MAX_MOTOR_TORQUE) : 0;
+#endif // end of pwm dither
+  m->neg = (hi < lo) ? 0xFFFFFFFF : 0;
+}
+
+void pwmSetConst(u8 out, s32 v) { // output does not depend on torque
+  for (u8 i = 0; i < 3; i++) pwmSetMap(out, i, v, v);
+}
+
+#endif // _PWM_MAP_H_
@@ -0,0 +1,56 @@
+#ifndef _TWI_H_
+#define _TWI_H_
+
+// Interrupt driven i2C master for ATmega32U4 TWI hardware (option USE_TWI_ASYNC)
+// Transfers are queued as jobs, grouped in batches, and TWI_vect runs them in the background while the firmware does other work.
+// This engine owns TWI_vect, so Wire library (and AS5600, ADS1015, MCP4725 and LCD libraries that use it) is not compiled in with USE_TWI_ASYNC.
+// Each batch reports its result into a status byte of its owner, batches of different owners may be queued at the same time.
+
+#define TWI_FREQ_FAST   400000L // fast mode i2C clock, supported by AS5600, TCA9548, ADS1015 and MCP4725
+#define TWI_JOBS        8 // max number of queued transfers, power of 2 (AS5600 prefetch with mux, ADS1015 and MCP4725 batch at the same time)
+#define TWI_BATCH_MAX   4 // largest batch any caller queues at once (AS5600 prefetch with mux), ADS1015 and MCP4725 queue 2
+#define TWI_TIMEOUT     1000 // us, max time for twiWait() before we reset a stuck bus
+
+// bus time estimates used to queue AS5600 reads early enough before the control tick
+#define TWI_BYTE_US     28 // us per byte, 9 clocks at 400kHz (22.5us) plus ~5us of interrupt before the next byte is started
+#define TWI_JOB_US      10 // us for start, repeated start and stop conditions of one job
+#define TWI_JOB_TIME(n) ((n) * TWI_BYTE_US + TWI_JOB_US) // job with n bytes on the bus (address bytes included)
+#ifdef USE_TCA9548
+#define TWI_AS5600_US   (AS5600_NUM * (TWI_JOB_TIME(2) + TWI_JOB_TIME(5))) // mux write and angle read (addr, reg, addr, 2 data) per sensor
+#else
+#define TWI_AS5600_US   (AS5600_NUM * TWI_JOB_TIME(5))
+#endif // end of tca
+#ifdef USE_ADS1015
+#define TWI_ADS_US      (TWI_JOB_TIME(4) + TWI_JOB_TIME(5)) // config write and result read
+#else
+#define TWI_ADS_US      0
+#endif // end of ads1015
+#ifdef USE_MCP4725
+#define TWI_DAC_US      (2 * TWI_JOB_TIME(3)) // fast write to both DACs
+#else
+#define TWI_DAC_US      0
+#endif // end of mcp4725
+#define TWI_PREFETCH_US (TWI_AS5600_US + TWI_ADS_US + TWI_DAC_US + 50) // us, queue AS5600 reads this long before the control tick, other batches may be ahead of them in the queue, 50us for the loop pass that notices it
+
+typedef struct twiJob {
+  u8 addr; // 7bit i2C address
+  u8 nw; // number of bytes to write from wbuf
+  u8 nr; // number of bytes to read into rbuf (after repeated start, or right away if nw=0)
+  u8 wbuf[3];
+  u8 *rbuf;
+  volatile u8 *status; // set on the last job of a batch by twiGo(), NULL on the others
+};
+
+#define TWI_DONE     0 // batch status, last batch was transferred
+#define TWI_PENDING  1 // batch is queued or on the bus
+#define TWI_FAILED   2 // a slave did not ack, bus error or timeout, rest of the batch was dropped
+
+#define TWI_IDLE     0
+#define TWI_BUSY     1
+
+extern volatile u16 twiErrors;
+
+static_assert(TWI_BATCH_MAX <= TWI_JOBS, "twi queue is too small for largest batch");
+static_assert((TWI_JOBS & (TWI_JOBS - 1)) == 0, "twi queue size must be a power of 2");
+
+#endif // _TWI_H_
@@ -0,0 +1,140 @@
+#include "Config.h"
+
+#ifdef USE_TWI_ASYNC
+#include "twi.h"
+
+//--------------------------------------- Globals --------------------------------------------------------
+
+twiJob twiQueue[TWI_JOBS]; // ring of queued transfers, executed in order
+volatile u8 twiHead = 0; // job on the bus (or next one to run), only moved by TWI interrupt
+volatile u8 twiPub = 0; // end of jobs handed over to TWI interrupt by twiGo()
+u8 twiTail = 0; // end of jobs being queued, jobs from twiPub up to here are not started yet
+u8 twiIdx = 0; // byte index within current job
+volatile u8 twiState = TWI_IDLE;
+b8 twiReading = false; // true once we have switched current job to master receiver
+volatile u16 twiErrors = 0; // number of failed batches since powerup
+
+//--------------------------------------------------------------------------------------------------------
+
+void twiInit() { // 400kHz master, internal pullups on as Wire.begin() does
+  digitalWrite(SDA, HIGH);
+  digitalWrite(SCL, HIGH);
+  TWSR = 0; // prescaler 1
+  TWBR = ((F_CPU / TWI_FREQ_FAST) - 16) / 2;
+  TWCR = _BV(TWEN);
+}
+
+// returns next free job slot, caller fills in address and data and then starts its batch with twiGo(), returns NULL if queue is full
+twiJob* twiNewJob(u8 addr) {
+  if ((u8)(twiTail - twiHead) >= TWI_JOBS) return NULL;
+  twiJob *j = &twiQueue[twiTail++ & (TWI_JOBS - 1)];
+  j->addr = addr;
+  j->nw = 0;
+  j->nr = 0;
+  j->rbuf = NULL;
+  j->status = NULL;
+  return j;
+}
+
+static void twiStartJob() {
+  twiIdx = 0;
+  twiReading = (twiQueue[twiHead & (TWI_JOBS - 1)].nw == 0); // pure read jobs go straight to SLA+R
+  twiState = TWI_BUSY;
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE); // send start condition
+}
+
+static void twiStopJob(b8 ok) { // called from TWI interrupt
+  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN); // every job ends with stop (TCA9548 only switches channel after stop)
+  while (TWCR & _BV(TWSTO)); // there is no interrupt for a sent stop, it takes about one bus clock (2.5us)
+  twiJob *j = &twiQueue[twiHead & (TWI_JOBS - 1)];
+  if (!ok) {
+    twiErrors++;
+    while (j->status == NULL) { // drop the rest of the batch, its last job is already handed over
+      twiHead++;
+      j = &twiQueue[twiHead & (TWI_JOBS - 1)];
+    }
+  }
+  if (j->status != NULL) *j->status = ok ? TWI_DONE : TWI_FAILED;
+  twiHead++;
+  if (twiHead != twiPub) {
+    twiStartJob();
+  } else {
+    twiState = TWI_IDLE;
+  }
+}
+
+void twiGo(volatile u8 *status) { // start jobs queued since last call as one batch, its result goes to status
+  if (twiTail == twiPub) return;
+  twiQueue[(twiTail - 1) & (TWI_JOBS - 1)].status = status;
+  *status = TWI_PENDING;
+  u8 oldSREG = SREG;
+  cli();
+  twiPub = twiTail;
+  if (twiState == TWI_IDLE) twiStartJob();
+  SREG = oldSREG;
+}
+
+u8 twiFree() { // number of jobs that can still be queued now
+  return TWI_JOBS - (u8)(twiTail - twiHead);
+}
+
+void twiWait(volatile u8 *status) { // block until batch is done (or bus is reset after a timeout), only for setup and serial commands
+  u32 t = micros();
+  while (*status == TWI_PENDING) {
+    if (micros() - t > TWI_TIMEOUT) {
+      u8 oldSREG = SREG;
+      cli();
+      TWCR = 0; // release the bus and restart TWI hardware
+      TWCR = _BV(TWEN);
+      for (; twiHead != twiPub; twiHead++) { // fail every started batch
+        twiJob *j = &twiQueue[twiHead & (TWI_JOBS - 1)];
+        if (j->status != NULL) *j->status = TWI_FAILED;
+      }
+      twiState = TWI_IDLE;
+      twiErrors++;
+      SREG = oldSREG;
+    }
+  }
+}
+
+ISR(TWI_vect) { // one step of TWI state machine each time hardware has finished a bus event
+  twiJob *j = &twiQueue[twiHead & (TWI_JOBS - 1)];
+  switch (TWSR & 0xF8) {
+    case 0x08: // start sent
+    case 0x10: // repeated start sent
+      TWDR = (j->addr << 1) | (twiReading ? 1 : 0);
+      TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+      break;
+    case 0x18: // SLA+W sent, ack received
+    case 0x28: // data sent, ack received
+      if (twiIdx < j->nw) {
+        TWDR = j->wbuf[twiIdx++];
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+      } else if (j->nr > 0) {
+        twiReading = true;
+        twiIdx = 0;
+        TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE); // repeated start for reading
+      } else {
+        twiStopJob(true);
+      }
+      break;
+    case 0x50: // data received, ack returned
+      j->rbuf[twiIdx++] = TWDR;
+    // no break, set up reception of the next byte
+    case 0x40: // SLA+R sent, ack received
+      if (twiIdx + 1 < j->nr) {
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE) | _BV(TWEA); // ack, more bytes to come
+      } else {
+        TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWIE); // nack the last byte
+      }
+      break;
+    case 0x58: // last data byte received, nack returned
+      j->rbuf[twiIdx] = TWDR;
+      twiStopJob(true);
+      break;
+    default: // slave did not ack, arbitration lost or bus error
+      twiStopJob(false);
+      break;
+  }
+}
+#endif // end of twi async